@@ -0,0 +1,105 @@
+/**
+ * Benchmark helpers
+ * The clock, temporary log directories and table hooks shared by the
+ * benchmarks. Only included by the benchmark programs.
+ *
+ * @author Perry David Ralston Jr.
+ * @date 12/21/2020
+ */
+#ifndef BENCH
+#define BENCH
+
+#include <dirent.h>
+#include <err.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * now
+ * @return: seconds on the monotonic clock
+ **/
+static inline double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Log_Dir
+ * Fresh directory under /tmp for one table's log, so tables never share
+ * a log. Removed along with whatever the table left in it.
+ **/
+class Log_Dir
+{
+  public:
+	char path[64];
+	Log_Dir(const char *name)
+	{
+		snprintf(path, sizeof(path), "/tmp/%s.XXXXXX", name);
+		if(mkdtemp(path) == NULL)
+			err(2, "mkdtemp");
+	}
+	~Log_Dir()
+	{
+		DIR *dir = opendir(path);
+		if(dir != NULL) {
+			char file[sizeof(path) + NAME_MAX + 1];
+			struct dirent *entry;
+			while((entry = readdir(dir)) != NULL) {
+				if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+					continue;
+				snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+				unlink(file);
+			}
+			closedir(dir);
+		}
+		rmdir(path);
+	}
+};
+
+/**
+ * Bench_Hash
+ * Exposes the bucket level calls of a Basic_Hash, so a benchmark can
+ * hash its keys up front and time the table alone
+ **/
+template<class Table>
+class Bench_Hash : public Table
+{
+  public:
+	using Table::Table;
+	int32_t bucket(uint8_t *key)
+	{
+		return this->genHash(key);
+	}
+	int32_t bucket(uint8_t *key, uint64_t &hashed)
+	{
+		return this->genHash(key, &hashed);
+	}
+	int8_t insert(int32_t hash, uint64_t hashed, uint8_t *key, int64_t value)
+	{
+		return Table::template insert<int64_t>(hash, hashed, key, value);
+	}
+	int8_t find(int32_t hash, uint64_t hashed, uint8_t *key, int64_t &value)
+	{
+		const typename Table::Value_Type *found;
+		if(this->lookup(hash, hashed, key, found) == -1)
+			return -1;
+		if constexpr(Table::NUMERIC) {
+			value = *found;
+		} else {
+			value = found->data.num_val;
+		}
+		return 0;
+	}
+	int8_t erase(int32_t hash, uint64_t hashed, uint8_t *key)
+	{
+		return this->remove(hash, hashed, key);
+	}
+};
+
+#endif
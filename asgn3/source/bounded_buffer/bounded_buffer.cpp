@@ -7,20 +7,29 @@
  */
 
 #include "bounded_buffer.h"
+#include "shm_channel.h"
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 Bounded_Buffer::Bounded_Buffer()
 {
-	root = (uint8_t *)calloc(BUFFER_SIZE, sizeof(uint8_t));
+	// requests and responses get separate halves so pipelined requests
+	// survive while their responses are collected
+	root = (uint8_t *)calloc(2 * BUFFER_SIZE, sizeof(uint8_t));
 	start = end = root;
+	out_root = out_end = root + BUFFER_SIZE;
+	shm = nullptr;
 	client_fd = 0;
 }
 
@@ -28,10 +37,14 @@ Bounded_Buffer::~Bounded_Buffer()
 {
 	free(root);
 	root = start = end = NULL;
+	out_root = out_end = NULL;
+	delete shm;
 }
 
 void Bounded_Buffer::close_cl()
 {
+	delete shm;
+	shm = nullptr;
 	close(client_fd);
 	client_fd = 0;
 }
@@ -42,9 +55,28 @@ ssize_t Bounded_Buffer::fill()
 		start = root;
 	if(client_fd == 0)
 		return -1;
-	ssize_t bytes_read = recv(client_fd, root, BUFFER_SIZE, 0);
-	if(bytes_read == -1) {
-		err(EXIT_FAILURE, "%s", strerror(errno));
+	ssize_t bytes_read;
+	if(shm != nullptr) {
+		while((bytes_read = shm->read(root, BUFFER_SIZE)) == 0) {
+			if(shm->wait(false) == -1) {
+				close_cl();
+				return -1;
+			}
+		}
+		end = root + bytes_read;
+		return bytes_read;
+	}
+	// the socket is non-blocking, so wait out the rest of a partial request
+	while((bytes_read = recv(client_fd, root, BUFFER_SIZE, 0)) == -1) {
+		if(errno == ECONNRESET) {
+			close_cl();
+			return -1;
+		}
+		if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			err(EXIT_FAILURE, "%s", strerror(errno));
+		}
+		if(wait_for(POLLIN) == -1)
+			return -1;
 	}
 	if(bytes_read == 0) {
 		close_cl();
@@ -55,75 +87,400 @@ ssize_t Bounded_Buffer::fill()
 	return bytes_read;
 }
 
+/**
+ * wait_for
+ * @param events: poll(2) events to wait for on the client socket
+ * @return: 0 once the socket is ready, -1 if the client hung up
+ **/
+int8_t Bounded_Buffer::wait_for(short events)
+{
+	struct pollfd pfd = {client_fd, events, 0};
+	while(poll(&pfd, 1, -1) == -1) {
+		if(errno != EINTR)
+			err(EXIT_FAILURE, "%s", strerror(errno));
+	}
+	if((pfd.revents & (POLLERR | POLLNVAL)) != 0) {
+		close_cl();
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * request_ready
+ * @param request_size: framing function, returns the length of the request
+ *        at the front of the bytes, or 0 if more bytes are needed to tell
+ * @return: true if a whole request is buffered
+ *
+ * Reads whatever the socket has without blocking. Used by the workers so
+ * a client that sent half a request goes back to the event loop instead
+ * of holding a worker in fill(). A request too large for the buffer
+ * counts as ready and the rest of it is read as it is processed.
+ **/
+bool Bounded_Buffer::request_ready(size_t (*request_size)(const uint8_t *, size_t))
+{
+	if(shm != nullptr && shm->unpark() == -1) {
+		close_cl();
+		return false;
+	}
+	while(request_size(start, end - start) == 0) {
+		if(start == root && end == root + BUFFER_SIZE)
+			return true;
+		if(!receive())
+			return false;
+	}
+	return true;
+}
+
+/**
+ * receive
+ * @return: true if more bytes were added behind the partial request
+ *
+ * Moves the partial request to the front of the buffer and appends
+ * whatever the socket has, without blocking.
+ **/
+bool Bounded_Buffer::receive()
+{
+	if(client_fd == 0)
+		return false;
+	if(start != root) {
+		memmove(root, start, end - start);
+		end = root + (end - start);
+		start = root;
+	}
+	if(shm != nullptr) {
+		size_t bytes_read = shm->read(end, root + BUFFER_SIZE - end);
+		end += bytes_read;
+		return bytes_read > 0;
+	}
+	ssize_t bytes_read = recv(client_fd, end, root + BUFFER_SIZE - end, 0);
+	if(bytes_read == -1) {
+		if(errno == ECONNRESET)
+			close_cl();
+		return false;
+	}
+	if(bytes_read == 0) {
+		close_cl();
+		return false;
+	}
+	end += bytes_read;
+	return true;
+}
+
+/**
+ * from_file
+ * @param file_d: file to read from, positioned at the first byte to send
+ * @param size: number of bytes to send
+ * @return: number of bytes read, -1 on error. Sets errno appropriately
+ *
+ * Queues the file behind the pending responses. Full buffers are sent
+ * with MSG_MORE and the last part stays queued for the end of the batch.
+ **/
 ssize_t Bounded_Buffer::from_file(int file_d, ssize_t size)
 {
 	ssize_t bytes_read = 0, curr_read = 0;
 	size_t bytes_rem = size;
-	flush();
 	while(bytes_rem > 0) {
-		size_t read_size = (BUFFER_SIZE > bytes_rem) ? bytes_rem : BUFFER_SIZE;
-		curr_read = read(file_d, start, read_size);
-		if(curr_read == -1) {
-			bytes_read = -1;
-			break;
+		if(out_end == out_root + BUFFER_SIZE && flush(true) == -1) {
+			return -1;
+		}
+		size_t space = out_root + BUFFER_SIZE - out_end;
+		size_t read_size = (space > bytes_rem) ? bytes_rem : space;
+		curr_read = read(file_d, out_end, read_size);
+		if(curr_read <= 0) {
+			if(curr_read == 0)
+				errno = EINVAL;
+			return -1;
 		}
-		end = root + curr_read;
+		out_end += curr_read;
 		bytes_read += curr_read;
 		bytes_rem = size - bytes_read;
-		if(flush() == -1) {
-			bytes_read = -1;
-			break;
-		}
 	}
 	return bytes_read;
 }
 
+/**
+ * send_file
+ * @param file_d: file to send from
+ * @param offset: offset into the file to start sending at
+ * @param size: number of bytes to send
+ * @return: number of bytes sent, -1 on error. Sets errno appropriately
+ *
+ * Sends the pending responses with MSG_MORE and then moves the file
+ * range from the page cache to the socket with sendfile(2). Falls back
+ * to from_file() when the file does not support sendfile. If the file
+ * ends early the response cannot be finished and the client is closed.
+ **/
+ssize_t Bounded_Buffer::send_file(int file_d, off_t offset, ssize_t size)
+{
+	if(shm != nullptr) {
+		if(lseek(file_d, offset, SEEK_SET) == -1)
+			return -1;
+		return from_file(file_d, size);
+	}
+	if(flush(true) == -1)
+		return -1;
+	ssize_t bytes_sent = 0, curr_sent;
+	while(bytes_sent < size) {
+		curr_sent = sendfile(client_fd, file_d, &offset, size - bytes_sent);
+		if(curr_sent == -1) {
+			if(bytes_sent == 0 && (errno == EINVAL || errno == ENOSYS)) {
+				if(lseek(file_d, offset, SEEK_SET) == -1)
+					return -1;
+				return from_file(file_d, size);
+			}
+			if(errno == EPIPE || errno == ECONNRESET) {
+				close_cl();
+				return -1;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				return -1;
+			}
+			if(wait_for(POLLOUT) == -1)
+				return -1;
+			continue;
+		}
+		if(curr_sent == 0) {
+			close_cl();
+			errno = EINVAL;
+			return -1;
+		}
+		bytes_sent += curr_sent;
+	}
+	return bytes_sent;
+}
+
+/**
+ * dump
+ * @param dump_size: number of request bytes to throw away
+ **/
 void Bounded_Buffer::dump(uint16_t dump_size)
 {
-	uint16_t bytes_dumped = 0;
-	while(bytes_dumped < dump_size) {
-		bytes_dumped += fill();
-		clear();
+	size_t bytes_rem = dump_size, avail;
+	while(bytes_rem > 0) {
+		if(isEmpty() && fill() == -1)
+			return;
+		avail = end - start;
+		avail = avail < bytes_rem ? avail : bytes_rem;
+		start += avail;
+		bytes_rem -= avail;
 	}
 }
 
-ssize_t Bounded_Buffer::flush()
+/**
+ * flush
+ * @param more: more of the response follows, send with MSG_MORE
+ * @return: number of bytes sent, -1 if the client hung up
+ **/
+ssize_t Bounded_Buffer::flush(bool more)
 {
-	if(start == end) {
-		// buffer is empty start and end may not be set to root
-		clear();
+	if(out_end == out_root) {
 		return 0;
 	}
-	ssize_t flush_length = end - start;
+	ssize_t bytes_sent = send_bytes(out_root, out_end - out_root, more);
+	if(bytes_sent == -1)
+		return -1;
+	clear();
+	return bytes_sent;
+}
+
+/**
+ * flush_now
+ * @return: number of bytes sent, -1 if the client hung up or, with errno
+ *          set to EAGAIN, if some responses are still queued
+ *
+ * Sends what the socket or ring takes right away and keeps the rest at
+ * the front of the buffer, for callers that must never wait on a client
+ **/
+ssize_t Bounded_Buffer::flush_now()
+{
 	if(client_fd == 0)
 		return -1;
-	ssize_t bytes_sent = send(client_fd, start, flush_length, 0);
-	if(bytes_sent == -1) {
-		err(EXIT_FAILURE, "%s", strerror(errno));
+	ssize_t size = out_end - out_root, bytes_sent = 0, curr_sent;
+	while(bytes_sent < size) {
+		if(shm != nullptr) {
+			curr_sent = shm->write(out_root + bytes_sent, size - bytes_sent);
+			if(curr_sent == 0)
+				break;
+		} else {
+			curr_sent = send(client_fd, out_root + bytes_sent, size - bytes_sent,
+			  MSG_NOSIGNAL | MSG_DONTWAIT);
+			if(curr_sent == -1) {
+				if(errno == EINTR)
+					continue;
+				if(errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				close_cl();
+				return -1;
+			}
+		}
+		bytes_sent += curr_sent;
 	}
-	if(bytes_sent < flush_length) {
-		close_cl();
+	memmove(out_root, out_root + bytes_sent, size - bytes_sent);
+	out_end -= bytes_sent;
+	if(out_end != out_root) {
+		errno = EAGAIN;
 		return -1;
 	}
-	clear();
 	return bytes_sent;
 }
 
+/**
+ * send_bytes
+ * @param bytes: bytes to send to the client
+ * @param size: number of bytes to send
+ * @param more: more of the response follows, send with MSG_MORE
+ * @return: number of bytes sent, -1 if the client hung up
+ *
+ * Sends all of size, waiting on the non-blocking socket when it is full
+ **/
+ssize_t Bounded_Buffer::send_bytes(const uint8_t *bytes, ssize_t size, bool more)
+{
+	if(client_fd == 0)
+		return -1;
+	ssize_t bytes_sent = 0, curr_sent;
+	if(shm != nullptr) {
+		while(bytes_sent < size) {
+			curr_sent = shm->write(bytes + bytes_sent, size - bytes_sent);
+			if(curr_sent == 0 && shm->wait(true) == -1) {
+				close_cl();
+				return -1;
+			}
+			bytes_sent += curr_sent;
+		}
+		return bytes_sent;
+	}
+	int flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+	while(bytes_sent < size) {
+		curr_sent = send(client_fd, bytes + bytes_sent, size - bytes_sent, flags);
+		if(curr_sent == -1) {
+			if(errno == EPIPE || errno == ECONNRESET) {
+				close_cl();
+				return -1;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				err(EXIT_FAILURE, "%s", strerror(errno));
+			}
+			if(wait_for(POLLOUT) == -1)
+				return -1;
+			continue;
+		}
+		bytes_sent += curr_sent;
+	}
+	return bytes_sent;
+}
+
+/**
+ * to_file
+ * @param file_d: file to write to, positioned at the first byte to write
+ * @param size: number of request bytes to write
+ * @return: number of bytes written, -1 on error. Sets errno appropriately
+ *
+ * Writes exactly size bytes of the request, anything behind them
+ * belongs to the next pipelined request.
+ **/
 ssize_t Bounded_Buffer::to_file(int file_d, ssize_t size)
 {
-	ssize_t bytes_written = write(file_d, start, end - start);
-	if(bytes_written == -1) {
-		return bytes_written;
+	ssize_t bytes_written = 0, curr_written, avail;
+	while(bytes_written < size) {
+		if(isEmpty() && fill() == -1)
+			return -1;
+		avail = end - start;
+		avail = avail < size - bytes_written ? avail : size - bytes_written;
+		curr_written = write(file_d, start, avail);
+		if(curr_written == -1)
+			return -1;
+		start += curr_written;
+		bytes_written += curr_written;
+	}
+	return bytes_written;
+}
+
+/**
+ * splice_to_file
+ * @param file_d: file to write to, positioned at the first byte to write
+ * @param size: number of request bytes to write
+ * @param pipe_fds: pipe owned by the calling worker, empty on entry
+ * @return: number of bytes written, -1 on error. Sets errno appropriately
+ *
+ * Writes the part of the payload that is already buffered, then splices
+ * the rest from the socket through the pipe into the file so it never
+ * passes through userspace. On a file error the rest of the payload is
+ * still consumed so the next request starts in the right place.
+ **/
+ssize_t Bounded_Buffer::splice_to_file(int file_d, ssize_t size, int *pipe_fds)
+{
+	ssize_t buffered = end - start;
+	buffered = buffered < size ? buffered : size;
+	uint8_t *first = start;
+	if(to_file(file_d, buffered) == -1) {
+		int saved = errno;
+		dump(size - (start - first));
+		errno = saved;
+		return -1;
 	}
-	while(bytes_written != size) {
-		fill();
-		if(write(file_d, start, end - start) == -1)
+	ssize_t bytes_written = buffered, in_pipe, curr_written;
+	if(shm != nullptr && bytes_written < size)
+		return to_file(file_d, size - bytes_written) == -1 ? -1 : size;
+	while(bytes_written < size) {
+		in_pipe = splice(client_fd, NULL, pipe_fds[1], NULL, size - bytes_written,
+		  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if(in_pipe == -1) {
+			if(errno == EINVAL) {
+				// the socket cannot be spliced, copy the rest
+				return to_file(file_d, size - bytes_written) == -1 ? -1 : size;
+			}
+			if(errno == ECONNRESET) {
+				close_cl();
+				return -1;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				err(EXIT_FAILURE, "%s", strerror(errno));
+			}
+			if(wait_for(POLLIN) == -1)
+				return -1;
+			continue;
+		}
+		if(in_pipe == 0) {
+			close_cl();
 			return -1;
-		bytes_written += (end - start);
+		}
+		while(in_pipe > 0) {
+			curr_written = splice(pipe_fds[0], NULL, file_d, NULL, in_pipe, SPLICE_F_MOVE);
+			if(curr_written == -1) {
+				if(errno == EINTR)
+					continue;
+				int saved = errno;
+				drain_pipe(pipe_fds[0], in_pipe);
+				dump(size - bytes_written - in_pipe);
+				errno = saved;
+				return -1;
+			}
+			in_pipe -= curr_written;
+			bytes_written += curr_written;
+		}
 	}
 	return bytes_written;
 }
 
+/**
+ * drain_pipe
+ * Throws away bytes left in a worker's pipe after a failed splice
+ **/
+void Bounded_Buffer::drain_pipe(int pipe_out, ssize_t size)
+{
+	uint8_t discard[4096];
+	ssize_t curr_read;
+	while(size > 0) {
+		curr_read = read(pipe_out, discard, (size_t)size < sizeof(discard) ? size : sizeof(discard));
+		if(curr_read == -1 && errno == EINTR)
+			continue;
+		if(curr_read <= 0)
+			return;
+		size -= curr_read;
+	}
+}
+
 uint8_t *Bounded_Buffer::getByte()
 {
 	if(isEmpty()) {
@@ -135,36 +492,145 @@ uint8_t *Bounded_Buffer::getByte()
 	return ret_val;
 }
 
+/**
+ * getBytes
+ * @param size: number of request bytes to copy
+ * @param dest: where to copy them
+ * @return: 0 on success, -1 if the client hung up
+ *
+ * Copies whole contiguous runs and only refills at the end of the buffer
+ **/
 int8_t Bounded_Buffer::getBytes(size_t size, uint8_t *dest)
 {
-	uint8_t *curr_byte = NULL;
-	for(size_t i = 0; i < size; ++i) {
-		curr_byte = getByte();
-		if(curr_byte == NULL) {
+	size_t run;
+	while(size > 0) {
+		if(isEmpty() && fill() == -1)
 			return -1;
-		}
-		dest[i] = *curr_byte;
+		run = end - start;
+		run = run < size ? run : size;
+		memcpy(dest, start, run);
+		start += run;
+		dest += run;
+		size -= run;
 	}
 	return 0;
 }
 
 int8_t Bounded_Buffer::pushByte(uint8_t in_byte)
 {
-	if(end == root + BUFFER_SIZE) {
-		if(flush() == -1) {
+	if(out_end == out_root + BUFFER_SIZE) {
+		// the batch is not finished yet
+		if(flush(true) == -1) {
 			return -1;
 		}
 	}
-	end[0] = in_byte;
-	++end;
+	out_end[0] = in_byte;
+	++out_end;
 	return 0;
 }
 
+/**
+ * pushBytes
+ * @param size: number of response bytes to queue
+ * @param in_bytes: bytes to queue
+ * @return: 0 on success, -1 if the client hung up
+ *
+ * Copies whole contiguous runs and only flushes when the buffer is full
+ **/
 int8_t Bounded_Buffer::pushBytes(size_t size, uint8_t *in_bytes)
 {
-	for(size_t i = 0; i < size; ++i) {
-		if(pushByte(in_bytes[i]) == -1)
+	size_t run;
+	while(size > 0) {
+		if(out_end == out_root + BUFFER_SIZE && flush(true) == -1)
 			return -1;
+		run = out_root + BUFFER_SIZE - out_end;
+		run = run < size ? run : size;
+		memcpy(out_end, in_bytes, run);
+		out_end += run;
+		in_bytes += run;
+		size -= run;
+	}
+	return 0;
+}
+/**
+ * attach_shm
+ * @param reply: response to the attach request
+ * @param size: length of the response
+ * @return: 0 on success, -1 on error. Sets errno appropriately
+ *
+ * Moves the connection onto a new shared memory channel. The pending
+ * responses and the reply go out on the socket, the reply carrying the
+ * channel's descriptors, and every byte after that uses the rings.
+ * Only unix domain sockets can pass descriptors.
+ **/
+int8_t Bounded_Buffer::attach_shm(const uint8_t *reply, size_t size)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	if(shm != nullptr || getsockname(client_fd, (struct sockaddr *)&addr, &addr_len) == -1
+		|| addr.ss_family != AF_UNIX) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	if(flush() == -1)
+		return -1;
+	Shm_Channel *channel = Shm_Channel::create(client_fd);
+	if(channel == nullptr)
+		return -1;
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * Shm_Channel::SHARED_FDS)];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {(void *)reply, size};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * Shm_Channel::SHARED_FDS);
+	memcpy(CMSG_DATA(cmsg), channel->shared_fds(), sizeof(int) * Shm_Channel::SHARED_FDS);
+	// the reply is tiny, an empty socket takes it whole
+	while(sendmsg(client_fd, &msg, MSG_NOSIGNAL) == -1) {
+		if(errno == EAGAIN || errno == EWOULDBLOCK) {
+			if(wait_for(POLLOUT) == -1) {
+				delete channel;
+				return -1;
+			}
+			continue;
+		}
+		if(errno == EINTR)
+			continue;
+		int saved = errno;
+		delete channel;
+		if(saved == EPIPE || saved == ECONNRESET)
+			close_cl();
+		errno = saved;
+		return -1;
 	}
+	shm = channel;
 	return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * watch_fd
+ * @return: descriptor the event loop waits on for this connection
+ **/
+int Bounded_Buffer::watch_fd()
+{
+	return shm != nullptr ? shm->watch_fd() : client_fd;
+}
+
+/**
+ * park
+ * Called before the connection goes back to the event loop, so a
+ * shared memory client knows to ring the doorbell for the next request
+ **/
+void Bounded_Buffer::park()
+{
+	if(shm != nullptr)
+		shm->park();
+}
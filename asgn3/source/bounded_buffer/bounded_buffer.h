@@ -11,23 +11,36 @@
 
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+class Shm_Channel;
+
 class Bounded_Buffer
 {
   private:
 	static const ssize_t BUFFER_SIZE = 16000;
+	// bytes received from the client
 	uint8_t *root;
 	uint8_t *start;
 	uint8_t *end;
-	void close_cl();
+	// responses waiting to be sent
+	uint8_t *out_root;
+	uint8_t *out_end;
+	// shared memory rings replacing the socket, see attach_shm
+	Shm_Channel *shm;
 	ssize_t fill();
+	int8_t wait_for(short);
+	void drain_pipe(int, ssize_t);
+	bool receive();
 
   public:
 	Bounded_Buffer();
@@ -36,20 +49,112 @@ class Bounded_Buffer
 	{
 		return start == end;
 	}
+	// buffered request bytes, valid until the next read from the buffer
+	const uint8_t *peek()
+	{
+		return start;
+	}
+	size_t buffered()
+	{
+		return end - start;
+	}
 	void clear()
 	{
-		start = end = root;
+		out_end = out_root;
 	}
+	// room left for responses before a push has to flush
+	size_t out_space()
+	{
+		return out_root + BUFFER_SIZE - out_end;
+	}
+	// false once the connection moved to shared memory
+	bool on_socket()
+	{
+		return shm == nullptr;
+	}
+	bool request_ready(size_t (*)(const uint8_t *, size_t));
+	// drops the client, also when its requests can no longer be followed
+	void close_cl();
+	int8_t attach_shm(const uint8_t *, size_t);
+	int watch_fd();
+	void park();
 	void dump(uint16_t);
 	ssize_t to_file(int, ssize_t);
-	ssize_t flush();
+	ssize_t splice_to_file(int, ssize_t, int *);
+	ssize_t flush(bool more = false);
+	ssize_t flush_now();
+	ssize_t send_bytes(const uint8_t *, ssize_t, bool more = false);
 	ssize_t from_file(int, ssize_t);
+	ssize_t send_file(int, off_t, ssize_t);
 	uint8_t *getByte();
 	int8_t getBytes(size_t size, uint8_t *dest);
 	int8_t pushByte(uint8_t in_byte);
 	int8_t pushBytes(size_t size, uint8_t *in_bytes);
+	template<class int_type>
+	int8_t getInt(int_type &value);
+	template<class int_type>
+	int8_t pushInt(int_type value);
 
 	int client_fd;
 };
 
+/**
+ * swap_nbo
+ * @param value: integer in network byte order, or host order
+ * @return: value converted to the other order
+ **/
+template<class int_type>
+static inline int_type swap_nbo(int_type value)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	switch(sizeof(value)) {
+	case 2:
+		return (int_type)__builtin_bswap16((uint16_t)value);
+	case 4:
+		return (int_type)__builtin_bswap32((uint32_t)value);
+	case 8:
+		return (int_type)__builtin_bswap64((uint64_t)value);
+	}
+#endif
+	return value;
+}
+
+/**
+ * getInt
+ * @param value: set to the next network order integer of the request
+ * @return: 0 on success, -1 if the client hung up
+ *
+ * Loads the integer with one copy and a byte swap when it is contiguous
+ * in the buffer, otherwise gathers it across the refill.
+ **/
+template<class int_type>
+int8_t Bounded_Buffer::getInt(int_type &value)
+{
+	if(end - start >= (ssize_t)sizeof(value)) {
+		memcpy(&value, start, sizeof(value));
+		start += sizeof(value);
+	} else if(getBytes(sizeof(value), (uint8_t *)&value) == -1) {
+		return -1;
+	}
+	value = swap_nbo(value);
+	return 0;
+}
+
+/**
+ * pushInt
+ * @param value: integer to queue in network byte order
+ * @return: 0 on success, -1 if the client hung up
+ **/
+template<class int_type>
+int8_t Bounded_Buffer::pushInt(int_type value)
+{
+	value = swap_nbo(value);
+	if(out_root + BUFFER_SIZE - out_end >= (ssize_t)sizeof(value)) {
+		memcpy(out_end, &value, sizeof(value));
+		out_end += sizeof(value);
+		return 0;
+	}
+	return pushBytes(sizeof(value), (uint8_t *)&value);
+}
+
 #endif
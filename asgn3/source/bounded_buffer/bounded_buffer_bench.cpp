@@ -0,0 +1,185 @@
+/**
+ * Bounded_Buffer parsing benchmark
+ *
+ * Streams requests through a socketpair and measures how many bytes per
+ * second the reader parses. Compares the old byte at a time decode
+ * (getByte per byte, integers shifted together) against the bulk
+ * getBytes/getInt path. Two workloads: math requests, which are all
+ * small integers, and write requests, which are mostly payload.
+ *
+ * usage: ./bounded_buffer_bench [requests]
+ *
+ * @author Perry David Ralston Jr
+ * @date 12/09/2020
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "bounded_buffer.h"
+
+static const uint16_t PAYLOAD_SIZE = 4096;
+
+struct stream {
+	int sock;
+	uint8_t *bytes;
+	size_t size;
+	int64_t repeat;
+};
+
+void *writer(void *arg)
+{
+	stream *self = (stream *)arg;
+	for(int64_t i = 0; i < self->repeat; ++i) {
+		size_t sent = 0;
+		while(sent < self->size) {
+			ssize_t curr = write(self->sock, self->bytes + sent, self->size - sent);
+			if(curr == -1)
+				err(2, "write");
+			sent += curr;
+		}
+	}
+	return NULL;
+}
+
+/*----------byte at a time (previous decode) --------------*/
+
+template<class int_type>
+int8_t old_get_int(Bounded_Buffer &b_buff, int_type &value)
+{
+	value = 0;
+	for(size_t i = 0; i < sizeof(value); ++i) {
+		uint8_t *curr_byte = b_buff.getByte();
+		if(curr_byte == NULL)
+			return -1;
+		value = (value << 8) + *curr_byte;
+	}
+	return 0;
+}
+
+int8_t old_get_bytes(Bounded_Buffer &b_buff, size_t size, uint8_t *dest)
+{
+	for(size_t i = 0; i < size; ++i) {
+		uint8_t *curr_byte = b_buff.getByte();
+		if(curr_byte == NULL)
+			return -1;
+		dest[i] = *curr_byte;
+	}
+	return 0;
+}
+
+/*----------requests --------------*/
+
+// op, ident, a, b
+void parse_math(Bounded_Buffer &b_buff, bool bulk, int64_t &sum)
+{
+	uint16_t op;
+	uint32_t ident;
+	int64_t a, b;
+	if(bulk) {
+		b_buff.getInt(op);
+		b_buff.getInt(ident);
+		b_buff.getInt(a);
+		b_buff.getInt(b);
+	} else {
+		old_get_int(b_buff, op);
+		old_get_int(b_buff, ident);
+		old_get_int(b_buff, a);
+		old_get_int(b_buff, b);
+	}
+	sum += op + ident + a + b;
+}
+
+// op, ident, offset, size, payload
+void parse_write(Bounded_Buffer &b_buff, bool bulk, int64_t &sum)
+{
+	static uint8_t payload[PAYLOAD_SIZE];
+	uint16_t op, size;
+	uint32_t ident;
+	uint64_t offset;
+	if(bulk) {
+		b_buff.getInt(op);
+		b_buff.getInt(ident);
+		b_buff.getInt(offset);
+		b_buff.getInt(size);
+		b_buff.getBytes(size, payload);
+	} else {
+		old_get_int(b_buff, op);
+		old_get_int(b_buff, ident);
+		old_get_int(b_buff, offset);
+		old_get_int(b_buff, size);
+		old_get_bytes(b_buff, size, payload);
+	}
+	sum += op + ident + offset + payload[size - 1];
+}
+
+size_t math_request(uint8_t *dest)
+{
+	uint8_t req[] = {0x01, 0x01, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 4};
+	memcpy(dest, req, sizeof(req));
+	return sizeof(req);
+}
+
+size_t write_request(uint8_t *dest)
+{
+	uint8_t req[] = {0x02, 0x02, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, PAYLOAD_SIZE >> 8,
+	  PAYLOAD_SIZE & 0xFF};
+	memcpy(dest, req, sizeof(req));
+	memset(dest + sizeof(req), 0x5a, PAYLOAD_SIZE);
+	return sizeof(req) + PAYLOAD_SIZE;
+}
+
+double bench(size_t (*build)(uint8_t *), void (*parse)(Bounded_Buffer &, bool, int64_t &),
+  bool bulk, int64_t requests)
+{
+	// a batch of requests per write keeps the writer off the critical path
+	const int64_t batch = 64;
+	int socks[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1)
+		err(2, "socketpair");
+	stream out;
+	out.sock = socks[1];
+	out.bytes = (uint8_t *)malloc(batch * (PAYLOAD_SIZE + 64));
+	out.size = 0;
+	for(int64_t i = 0; i < batch; ++i) {
+		out.size += build(out.bytes + out.size);
+	}
+	out.repeat = requests / batch;
+	Bounded_Buffer b_buff;
+	b_buff.client_fd = socks[0];
+	pthread_t tid;
+	pthread_create(&tid, NULL, writer, &out);
+	int64_t sum = 0;
+	double begin = now();
+	for(int64_t i = 0; i < out.repeat * batch; ++i) {
+		parse(b_buff, bulk, sum);
+	}
+	double elapsed = now() - begin;
+	pthread_join(tid, NULL);
+	if(sum == 0)
+		printf("unexpected sum\n");
+	close(socks[0]);
+	close(socks[1]);
+	b_buff.client_fd = 0;
+	double bytes = (double)out.size * out.repeat;
+	free(out.bytes);
+	return bytes / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	int64_t requests = argc > 1 ? atol(argv[1]) : 1000000;
+	printf("%8s %20s %20s\n", "request", "byte loop (MB/s)", "bulk (MB/s)");
+	printf("%8s %20.1f %20.1f\n", "math", bench(math_request, parse_math, false, requests) / 1e6,
+	  bench(math_request, parse_math, true, requests) / 1e6);
+	requests /= 16;
+	printf("%8s %20.1f %20.1f\n", "write", bench(write_request, parse_write, false, requests) / 1e6,
+	  bench(write_request, parse_write, true, requests) / 1e6);
+	return 0;
+}
@@ -0,0 +1,167 @@
+/** Epoch source file
+ *  Epoch based reclamation for lock-free structures
+ *
+ *  @author Perry David Ralston Jr.
+ *  @date 12/19/2020
+ */
+
+#include "epoch.h"
+#include <atomic>
+#include <err.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+Epoch::Epoch()
+{
+	global.store(0, std::memory_order_relaxed);
+	for(size_t i = 0; i < MAX_CHUNKS; ++i) {
+		chunks[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+/**
+ * ~Epoch
+ * Frees everything still retired, no thread may be inside the domain
+ **/
+Epoch::~Epoch()
+{
+	for(size_t i = 0; i < MAX_CHUNKS; ++i) {
+		record *chunk = chunks[i].load(std::memory_order_relaxed);
+		if(chunk == nullptr)
+			continue;
+		for(size_t j = 0; j < RECORD_CHUNK; ++j) {
+			for(size_t s = 0; s < SLOTS; ++s) {
+				release_all(chunk[j].limbo[s]);
+			}
+		}
+		free(chunk);
+	}
+}
+
+void Epoch::release_all(retired *list)
+{
+	while(list != nullptr) {
+		retired *temp = list;
+		list = list->next;
+		temp->release(temp->ptr);
+		free(temp);
+	}
+}
+
+/**
+ * get
+ * @return: the ident's record, allocating its chunk on first use
+ **/
+Epoch::record *Epoch::get(int64_t ident)
+{
+	if(ident < 0 || (size_t)ident >= MAX_IDENTS)
+		errx(EXIT_FAILURE, "epoch: ident %ld out of range", ident);
+	std::atomic<record *> &slot = chunks[ident / RECORD_CHUNK];
+	record *chunk = slot.load(std::memory_order_acquire);
+	if(chunk == nullptr) {
+		record *fresh = (record *)aligned_alloc(alignof(record), RECORD_CHUNK * sizeof(record));
+		if(fresh == nullptr)
+			err(EXIT_FAILURE, "epoch records");
+		memset((void *)fresh, 0, RECORD_CHUNK * sizeof(record));
+		if(slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) {
+			chunk = fresh;
+		} else {
+			free(fresh);
+		}
+	}
+	return &chunk[ident % RECORD_CHUNK];
+}
+
+/**
+ * enter
+ * @param ident: calling thread's identifier
+ *
+ * Announces the epoch the thread reads the structure in. Entering again
+ * before exit only counts the nesting. A thread that finds the epoch
+ * moved frees what it retired two or more epochs ago.
+ **/
+void Epoch::enter(int64_t ident)
+{
+	record *rec = get(ident);
+	if(rec->depth++ > 0)
+		return;
+	uint64_t curr = global.load(std::memory_order_seq_cst);
+	// a seq_cst exchange so the announcement is visible before any of
+	// the thread's reads
+	rec->local.exchange(curr << 1 | 1, std::memory_order_seq_cst);
+	if(curr != rec->seen) {
+		rec->seen = curr;
+		collect(rec, curr);
+	}
+}
+
+void Epoch::exit(int64_t ident)
+{
+	record *rec = get(ident);
+	if(--rec->depth == 0)
+		rec->local.store(0, std::memory_order_release);
+}
+
+/**
+ * collect
+ * Frees the limbo lists retired in epoch curr - 2 or earlier
+ **/
+void Epoch::collect(record *rec, uint64_t curr)
+{
+	for(size_t s = 0; s < SLOTS; ++s) {
+		if(rec->limbo[s] != nullptr && rec->limbo_epoch[s] + 2 <= curr) {
+			release_all(rec->limbo[s]);
+			rec->limbo[s] = nullptr;
+		}
+	}
+}
+
+/**
+ * retire
+ * @param ident: calling thread's identifier, inside the domain
+ * @param ptr: memory no longer reachable from the structure
+ * @param release: frees ptr once no thread can hold it
+ **/
+void Epoch::retire(int64_t ident, void *ptr, void (*release)(void *))
+{
+	record *rec = get(ident);
+	retired *entry = (retired *)malloc(sizeof(retired));
+	if(entry == nullptr)
+		err(EXIT_FAILURE, "epoch retire");
+	entry->ptr = ptr;
+	entry->release = release;
+	uint64_t curr = global.load(std::memory_order_seq_cst);
+	size_t s = curr % SLOTS;
+	// the slot last held epoch curr - 3 or earlier, safe to free now
+	if(rec->limbo[s] != nullptr && rec->limbo_epoch[s] != curr) {
+		release_all(rec->limbo[s]);
+		rec->limbo[s] = nullptr;
+	}
+	entry->next = rec->limbo[s];
+	rec->limbo[s] = entry;
+	rec->limbo_epoch[s] = curr;
+	if(++rec->pending % ADVANCE_EVERY == 0)
+		advance();
+}
+
+/**
+ * advance
+ * Moves the global epoch on if every thread inside the domain has
+ * announced the current one
+ **/
+void Epoch::advance()
+{
+	uint64_t curr = global.load(std::memory_order_seq_cst);
+	for(size_t i = 0; i < MAX_CHUNKS; ++i) {
+		record *chunk = chunks[i].load(std::memory_order_acquire);
+		if(chunk == nullptr)
+			continue;
+		for(size_t j = 0; j < RECORD_CHUNK; ++j) {
+			uint64_t local = chunk[j].local.load(std::memory_order_seq_cst);
+			if((local & 1) && (local >> 1) != curr)
+				return;
+		}
+	}
+	global.compare_exchange_strong(curr, curr + 1, std::memory_order_seq_cst);
+}
@@ -0,0 +1,63 @@
+/** Epoch header file
+ *  Epoch based reclamation for lock-free structures. Threads enter the
+ *  domain around every access, and memory they unlink is retired rather
+ *  than freed. The global epoch only moves on once every thread inside
+ *  the domain has seen the current one, so memory retired in epoch e is
+ *  freed once the epoch reaches e + 2, when nobody can still hold it.
+ *
+ *  Threads are told apart by the same ident they pass to SyncHash,
+ *  which must be unique among the threads running at once and below
+ *  MAX_IDENTS.
+ *
+ *  @author Perry David Ralston Jr.
+ *  @date 12/19/2020
+ */
+
+#ifndef EPOCH
+#define EPOCH
+
+#include <atomic>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+class Epoch
+{
+  public:
+	static const size_t RECORD_CHUNK = 64;
+	static const size_t MAX_CHUNKS = 256;
+	static const size_t MAX_IDENTS = RECORD_CHUNK * MAX_CHUNKS;
+	// retirements between a thread's attempts to advance the epoch
+	static const size_t ADVANCE_EVERY = 64;
+	Epoch();
+	~Epoch();
+	void enter(int64_t);
+	void exit(int64_t);
+	void retire(int64_t, void *, void (*)(void *));
+
+  private:
+	static const size_t SLOTS = 3;
+	struct retired {
+		retired *next;
+		void *ptr;
+		void (*release)(void *);
+	};
+	// per ident, only the owner touches anything but local
+	struct alignas(64) record {
+		// epoch << 1 | 1 while inside the domain, 0 outside
+		std::atomic<uint64_t> local;
+		uint32_t depth;
+		uint64_t seen;
+		size_t pending;
+		retired *limbo[SLOTS];
+		uint64_t limbo_epoch[SLOTS];
+	};
+	std::atomic<uint64_t> global;
+	std::atomic<record *> chunks[MAX_CHUNKS];
+	record *get(int64_t);
+	void advance();
+	void collect(record *, uint64_t);
+	static void release_all(retired *);
+};
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * Chain length distribution
+ *
+ * Loads a key corpus, one key per line, into a table for every hash
+ * policy and prints how many chains hold each number of records. Lines
+ * that are not valid keys are skipped. Set the stripes with -H as for
+ * rpcserver; stripes still double their chains as they fill.
+ *
+ * usage: ./chain_dist [-H stripes] <key_file>
+ *
+ * @author Perry David Ralston Jr
+ * @date 12/17/2020
+ */
+
+#include <err.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "hash.h"
+
+static const size_t MAX_LENGTH = 16;
+
+struct corpus {
+	uint8_t (*keys)[Hash::DEFAULT_SIZE];
+	size_t count;
+};
+
+corpus read_corpus(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL)
+		err(2, "%s", path);
+	corpus set = {NULL, 0};
+	size_t capacity = 0;
+	char line[256];
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if(strlen(line) >= Hash::DEFAULT_SIZE)
+			continue;
+		if(set.count == capacity) {
+			capacity = capacity == 0 ? 1024 : capacity * 2;
+			set.keys = (uint8_t(*)[Hash::DEFAULT_SIZE])realloc(set.keys, capacity * Hash::DEFAULT_SIZE);
+		}
+		strcpy((char *)set.keys[set.count++], line);
+	}
+	fclose(fp);
+	return set;
+}
+
+template<class Policy>
+void distribution(corpus &set, size_t stripes, char *log_dir)
+{
+	Basic_Hash<Policy> *table = new Basic_Hash<Policy>(stripes, Hash::DEFAULT_RECUR, log_dir);
+	size_t loaded = 0;
+	for(size_t i = 0; i < set.count; ++i) {
+		if(table->insert(set.keys[i], (int64_t)i) == 0)
+			++loaded;
+	}
+	size_t histogram[MAX_LENGTH + 1];
+	table->chain_lengths(histogram, MAX_LENGTH + 1);
+	size_t chains = 0, longest = 0;
+	double sum_sq = 0;
+	for(size_t n = 0; n <= MAX_LENGTH; ++n) {
+		chains += histogram[n];
+		sum_sq += (double)histogram[n] * n * n;
+		if(histogram[n] != 0)
+			longest = n;
+	}
+	double mean = (double)loaded / chains;
+	printf("%s: %zu keys, %zu chains, mean %.2f, stddev %.2f, longest %zu%s\n", Policy::NAME,
+	  loaded, chains, mean, sqrt(sum_sq / chains - mean * mean), longest,
+	  longest == MAX_LENGTH ? "+" : "");
+	for(size_t n = 0; n <= longest; ++n) {
+		printf("%4zu%s %8zu\n", n, n == MAX_LENGTH ? "+" : " ", histogram[n]);
+	}
+	delete table;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t stripes = Hash::DEFAULT_SIZE;
+	int opt;
+	while((opt = getopt(argc, argv, "H:")) != -1) {
+		if(opt == 'H')
+			stripes = atol(optarg);
+	}
+	if(argv[optind] == NULL)
+		errx(2, "usage: ./chain_dist [-H stripes] <key_file>");
+	corpus set = read_corpus(argv[optind]);
+	Log_Dir log_dir("chain_dist");
+	distribution<Djb2_Hash>(set, stripes, log_dir.path);
+	distribution<Fnv_Hash>(set, stripes, log_dir.path);
+	distribution<Wy_Hash>(set, stripes, log_dir.path);
+	free(set.keys);
+	return 0;
+}
@@ -6,13 +6,11 @@
  * @date 11/12/2020
  */
 
-#include <cmath>
 #include <ctype.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
-#include <regex>
 #include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,17 +19,63 @@
 
 #include "hash.h"
 
-Node::~Node() {
-	free(key);
-	key = nullptr;
-	if (!isNum) {
-		free(data.var_val);
+template<class Value>
+Node_Pool<Value>::~Node_Pool() {
+	while (slabs != nullptr) {
+		slab* temp = slabs;
+		slabs = slabs->next;
+		free(temp);
 	}
 }
 
-Hash::Hash(size_t size, uint16_t recur, char* _logdir) {
+/**
+ * alloc
+ * @return: a Node off the free list, carving a new slab when it is empty
+ **/
+template<class Value>
+typename Node_Pool<Value>::Node* Node_Pool<Value>::alloc() {
+	if (free_list == nullptr) {
+		slab* fresh = (slab*)malloc(sizeof(slab));
+		if (fresh == nullptr) {
+			err(EXIT_FAILURE, "node slab");
+		}
+		fresh->next = slabs;
+		slabs = fresh;
+		for (size_t i = 0; i < SLAB_NODES; ++i) {
+			release(&fresh->nodes[i]);
+		}
+	}
+	Node* node = free_list;
+	free_list = node->next;
+	return node;
+}
+
+/**
+ * retire
+ * Sets the stripe's old chains aside once nothing is left in them
+ **/
+template<class Value>
+static void retire(stripe<Value>& st)
+{
+	retired_chains* entry = (retired_chains*)malloc(sizeof(retired_chains));
+	if (entry == nullptr) {
+		err(EXIT_FAILURE, "retired chains");
+	}
+	entry->chains = st.old_chains;
+	entry->next = st.retired;
+	st.retired = entry;
+	__atomic_store_n(&st.old_chains, nullptr, __ATOMIC_RELAXED);
+}
+
+template<class Policy, class Value>
+Basic_Hash<Policy, Value>::Basic_Hash(size_t size, uint16_t recur, char* _logdir, Backend backend) {
 	tblSize = size > 0 ? size : DEFAULT_SIZE; 
-	hTable = (Node **)calloc(tblSize, sizeof(Node *));
+	hTable = (stripe<Value> *)calloc(tblSize, sizeof(stripe<Value>));
+	for (size_t i = 0; i < tblSize; ++i) {
+		hTable[i].chains = (Node **)calloc(1, sizeof(Node *));
+	}
+	pools = new Node_Pool<Value>[tblSize];
+	shards = backend == SWISS ? new Basic_Swiss_Table<Value>[tblSize] : nullptr;
 	recur_amt = 0 <= recur ? recur : DEFAULT_RECUR;
 	log_dir = open(_logdir, O_DIRECTORY);
 	if (log_dir == -1) {
@@ -57,10 +101,23 @@ Hash::Hash(size_t size, uint16_t recur, char* _logdir) {
 	load_dump();
 }
 
-Hash::~Hash() {
+template<class Policy, class Value>
+Basic_Hash<Policy, Value>::~Basic_Hash() {
 	clear();
 	fclose(logfile);
+	for (size_t i = 0; i < tblSize; ++i) {
+		free(hTable[i].chains);
+		free(hTable[i].old_chains);
+		while (hTable[i].retired != nullptr) {
+			retired_chains* temp = hTable[i].retired;
+			hTable[i].retired = temp->next;
+			free(temp->chains);
+			free(temp);
+		}
+	}
 	free(hTable);
+	delete[] pools;
+	delete[] shards;
 }
 
 /**
@@ -70,40 +127,53 @@ Hash::~Hash() {
  * Hashes the key and seeks for the matching node. Deletes the node and resolves
  * any dangling pointers that might result from the removal.
  **/
-int8_t Hash::remove(uint8_t *key)
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::remove(uint8_t *key)
 {
-	int32_t hash = genHash(key);
-	if (hash == -1 || remove(hash, key) == -1) {
+	uint64_t hashed;
+	int32_t hash = genHash(key, &hashed);
+	if (hash == -1) {
 		errno = ENOENT;
 		return -1;
 	}
-	if (!init_load) {
-		fprintf(logfile,"~%s=\n",key);
-		sync_log();
+	if (remove(hash, hashed, key) == -1) {
+		return -1;
 	}
+	log_remove(key);
 	return 0;
 }
 
-int8_t Hash::remove(int32_t hash, uint8_t* key)
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::remove(int32_t hash, uint64_t hashed, uint8_t* key)
 {
-	Node* current = hTable[hash];
+	if (shards != nullptr) {
+		if (shards[hash].erase(key) == 0) {
+			return 0;
+		}
+		errno = ENOENT;
+		return -1;
+	}
+	Node** head = find_chain(hash, hashed);
+	Node* current = *head;
 	if (current != nullptr && strcmp((char*)current->key, (char*)key) == 0) {
-		hTable[hash] = current->next;
-		delete(current);
+		__atomic_store_n(head, current->next, __ATOMIC_RELAXED);
+		pools[hash].release(current);
+		--hTable[hash].count;
 		return 0;		
 	}
 	Node* follower = current; 
 	while (current != nullptr) {
 		if (strcmp((char*)current->key, (char*)key) == 0) {
-			follower->next = current->next;
-			delete(current);
+			__atomic_store_n(&follower->next, current->next, __ATOMIC_RELAXED);
+			pools[hash].release(current);
+			--hTable[hash].count;
 			return 0;
 		}
 		follower = current;
 		current = current->next; 
 	}
 	//key not found in hashtable
-	errno = EINVAL;
+	errno = ENOENT;
 	return -1;
 }
 
@@ -119,16 +189,39 @@ int8_t Hash::remove(int32_t hash, uint8_t* key)
  * otherwise.
  **/
 
-int8_t Hash::lookup(uint8_t *key, int64_t& value)
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::lookup(uint8_t *key, int64_t& value)
+{
+	uint64_t hashed;
+	int32_t hash = genHash(key, &hashed);
+	if (hash == -1) {
+		errno = ENOENT;
+		return -1;
+	}
+	return lookup(hash, hashed, key, value);
+}
+
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::lookup(uint8_t *key, uint8_t* &value)
 {
-	Node* retrvd = nullptr;
-	int32_t hash = genHash(key);
+	uint64_t hashed;
+	int32_t hash = genHash(key, &hashed);
 	if (hash == -1) {
 		errno = ENOENT;
 		return -1;
 	}
-	if (lookup(hash, key, retrvd) == 0) {
-		if (retrvd->isNum) {
+	return lookup(hash, hashed, key, value);
+}
+
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::lookup(int32_t hash, uint64_t hashed, uint8_t* key, int64_t& value)
+{
+	const Value* retrvd;
+	if (lookup(hash, hashed, key, retrvd) == 0) {
+		if constexpr (NUMERIC) {
+			value = *retrvd;
+			return 0;
+		} else if (retrvd->isNum) {
 			value = retrvd->data.num_val;
 			return 0;
 		}
@@ -137,57 +230,69 @@ int8_t Hash::lookup(uint8_t *key, int64_t& value)
 	return -1;
 }
 
-int8_t Hash::lookup(uint8_t *key, uint8_t* &value)
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::lookup(int32_t hash, uint64_t hashed, uint8_t* key, uint8_t*& value)
 {
-	Node* retrvd = nullptr;
-	int32_t hash = genHash(key);
-	if (hash == -1) {
-		errno = ENOENT;
-		return -1;
-	}
-	if (lookup(hash, key, retrvd) == 0) {
-		if (!retrvd->isNum) {
-			strcpy((char*)value, (char*)retrvd->data.var_val);
-			return 0;
+	const Value* retrvd;
+	if (lookup(hash, hashed, key, retrvd) == 0) {
+		if constexpr (!NUMERIC) {
+			if (!retrvd->isNum) {
+				strcpy((char*)value, (char*)retrvd->data.var_val);
+				return 0;
+			}
 		}
 		errno = EFAULT;
 	}
 	return -1;
 }
 
-int8_t Hash::lookup(int32_t hash, uint8_t* key, Node*& value)
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::lookup(int32_t hash, uint64_t hashed, uint8_t* key, const Value*& value)
 {
-	Node* current = hTable[hash];
-	while (current != nullptr) {
-		if (strcmp((char*)current->key, (char*)key) == 0) {
-			value = current;
+	if (shards != nullptr) {
+		Record* slot = shards[hash].find(key);
+		if (slot != nullptr) {
+			value = &slot->value;
 			return 0;
 		}
-		current = current->next; 
+		errno = ENOENT;
+		return -1;
+	}
+	Node* current = find_node(hash, hashed, key);
+	if (current != nullptr) {
+		value = &current->value;
+		return 0;
 	}
 	//key not found in hashtable
 	errno = ENOENT;
 	return -1;
 }
 
-int8_t Hash::rlookup(uint8_t* key, int64_t& data, uint16_t recur) {
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::rlookup(uint8_t* key, int64_t& data, uint16_t recur) {
 	int32_t hash;
-	Node* retrvd = nullptr;
+	uint64_t hashed;
+	const Value* retrvd;
 
 	while (recur > 0) {
-		hash = genHash(key);
+		hash = genHash(key, &hashed);
 		if (hash == -1) {
 			errno = ENOENT;
 			return -1;
 		}
-		if (lookup(hash, key, retrvd) == -1) {
+		if (lookup(hash, hashed, key, retrvd) == -1) {
 			return -1;
 		}
-		if (retrvd->isNum) {
-			data = retrvd->data.num_val;
+		if constexpr (NUMERIC) {
+			data = *retrvd;
 			return 0;
+		} else {
+			if (retrvd->isNum) {
+				data = retrvd->data.num_val;
+				return 0;
+			}
+			key = (uint8_t*)retrvd->data.var_val;
 		}
-		key = retrvd->data.var_val;
 		--recur;	
 	}
 	errno = ELOOP;
@@ -198,20 +303,56 @@ int8_t Hash::rlookup(uint8_t* key, int64_t& data, uint16_t recur) {
  * Clear
  * clears all records from the hash table, freeing the associated memory
  **/
-void Hash::clear()
+template<class Policy, class Value>
+void Basic_Hash<Policy, Value>::clear()
+{
+	reset();
+	truncate_log();
+}
+
+/**
+ * reset
+ * Empties the buckets and leaves the log alone
+ **/
+template<class Policy, class Value>
+void Basic_Hash<Policy, Value>::reset()
 {
 	for (size_t i = 0; i < tblSize; ++i) {
-		Node* current = hTable[i];
-		while (current != nullptr) {
-			Node* temp = current;
-			current = current->next;
-			delete(temp);
+		if (shards != nullptr) {
+			shards[i].clear();
 		}
-		hTable[i] = nullptr;
-		fclose(logfile);
-		logfile = fdopen(openat(log_dir, LOGFILE, O_RDWR|O_TRUNC), "w+");
+		stripe<Value>& st = hTable[i];
+		for (size_t c = 0; c < chain_count(st); ++c) {
+			Node* current = chain_at(st, c);
+			while (current != nullptr) {
+				Node* temp = current;
+				current = current->next;
+				pools[i].release(temp);
+			}
+			__atomic_store_n(&chain_at(st, c), nullptr, __ATOMIC_RELAXED);
+		}
+		if (st.old_chains != nullptr) {
+			retire(st);
+		}
+		st.count = 0;
 	}
-	
+}
+
+/**
+ * truncate_log
+ * Empties the log in place. The stream lock keeps writers that do not
+ * hold the buckets, as under SyncHash's lock-free table, off it meanwhile.
+ **/
+template<class Policy, class Value>
+void Basic_Hash<Policy, Value>::truncate_log()
+{
+	flockfile(logfile);
+	fflush(logfile);
+	if (ftruncate(fileno(logfile), 0) == -1) {
+		warn("truncate %s", LOGFILE);
+	}
+	rewind(logfile);
+	funlockfile(logfile);
 }
 
 /**
@@ -223,50 +364,54 @@ void Hash::clear()
  * on a new line. This function has the same potential failures as open(2)
  * and write(2).
  **/
-int8_t Hash::dump(const char *filename)
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::dump(const char *filename)
 {
 	int fd = open(filename, O_WRONLY|O_CREAT|O_EXCL, S_IRWXU);
 	if (fd == -1) {
 		return -1; 
 	}
+	int8_t ret_val = visit([&](const uint8_t* key, const Value& value) {
+		return write_record(fd, key, value);
+	});
+	close(fd);
+	return ret_val;
+}
+
+/**
+ * write_record
+ * @param fd: file to write to, or -1 for the log
+ * @return: 0 on success, -1 otherwise. Sets errno appropriately
+ *
+ * Writes one key=value line
+ **/
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::write_record(int fd, const uint8_t* key, const Value& record)
+{
 	const size_t buff_size = 2*DEFAULT_SIZE + 3; //enough space to hold up to two var names and the formatting 
 	char buffer[buff_size];
 	int print_size;
-	for (size_t i = 0; i < tblSize; ++i) {
-		Node* current = hTable[i]; 
-		while ( current != nullptr) {
-			if(current->isNum){
-				print_size = snprintf(buffer, buff_size, "%s=%ld\n", current->key, current->data.num_val);
-			} else {
-				print_size = snprintf(buffer, buff_size, "%s=%s\n", current->key, current->data.var_val);
-			}
-			if (print_size < 0) { 
-				close(fd);
-				return -1; 
-			}
-			if (write(fd, buffer, print_size) == -1) { 
-				close(fd);
-				return -1; 
-			}
-			current = current->next;
-		}
+	if constexpr (NUMERIC) {
+		print_size = snprintf(buffer, buff_size, "%s=%ld\n", key, record);
+	} else if(record.isNum){
+		print_size = snprintf(buffer, buff_size, "%s=%ld\n", key, record.data.num_val);
+	} else {
+		print_size = snprintf(buffer, buff_size, "%s=%s\n", key, record.data.var_val);
 	}
-	close(fd);
-	return 0;
+	if (print_size < 0) { 
+		return -1; 
+	}
+	if (fd == -1) {
+		return fputs(buffer, logfile) == EOF ? -1 : 0;
+	}
+	return write(fd, buffer, print_size) == -1 ? -1 : 0;
 }
 
-void Hash::load_dump() {
-	for (size_t i = 0; i < tblSize; ++i) {
-		Node* current = hTable[i]; 
-		while ( current != nullptr) {
-			if(current->isNum) {
-				fprintf(logfile, "%s=%ld\n", current->key, current->data.num_val);
-			} else {
-				fprintf(logfile, "%s=%s\n", current->key, current->data.var_val);
-			}
-			current = current->next;
-		}
-	}
+template<class Policy, class Value>
+void Basic_Hash<Policy, Value>::load_dump() {
+	visit([&](const uint8_t* key, const Value& value) {
+		return write_record(-1, key, value);
+	});
 	fflush(logfile);
 }
 
@@ -279,7 +424,8 @@ void Hash::load_dump() {
  * This function has the same potential failures as open(2) and read(2). If line
  * is preceeded by a `~` charecter, then call remove on the key read on that line.
  **/
-int8_t Hash::load(const char *filename)
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::load(const char *filename)
 {
 	FILE* fp = fopen(filename, "r");
 	if (fp == nullptr) {
@@ -288,83 +434,292 @@ int8_t Hash::load(const char *filename)
 	return load(fp);
 }
 
-int8_t Hash::load(FILE* fp) {
-	uint8_t* key = nullptr;
-	uint8_t* value = nullptr;
-	char* endptr;
-	int64_t int_val;
-	int8_t chk_succ = 0;
-	int vals_read;
-
-	while ((vals_read = fscanf(fp," %m[^=]=%m[^\n]",&key,&value)) != EOF) {
-		if(vals_read == 0) {
-			errno = EINVAL;
-			fclose(fp);
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::load(FILE* fp) {
+	return read_records(fp, [this](uint8_t* key, auto value) { return insert(key, value); },
+	  [this](uint8_t* key) { remove(key); });
+}
+
+// character classes of a key, which matches [a-z][a-z0-9_]* ignoring case
+static const uint8_t KEY_FIRST = 0x1;
+static const uint8_t KEY_REST = 0x2;
+
+struct key_classes {
+	uint8_t of[256];
+	constexpr key_classes() : of() {
+		for (int c = 'a'; c <= 'z'; ++c) {
+			of[c] = of[c - 'a' + 'A'] = KEY_FIRST | KEY_REST;
+		}
+		for (int c = '0'; c <= '9'; ++c) {
+			of[c] = KEY_REST;
+		}
+		of['_'] = KEY_REST;
+	}
+};
+
+static constexpr key_classes KEY_CLASSES;
+
+/**
+ * scan_key
+ * @param key: null terminated key
+ * @param hashed: set to the key's hash if it is valid
+ * @return: 0 if the key is valid, -1 otherwise
+ *
+ * Validates and hashes the key in one pass, one table lookup and one
+ * hash step per character. Keys must be shorter than Hash::DEFAULT_SIZE.
+ **/
+template<class Policy>
+static inline int8_t scan_key(const uint8_t* key, uint64_t& hashed)
+{
+	typename Policy::state st;
+	uint8_t need = KEY_FIRST;
+	size_t i = 0;
+	Policy::begin(st);
+	for (; key[i] != '\0'; ++i) {
+		if ((KEY_CLASSES.of[key[i]] & need) == 0 || i == Hash::DEFAULT_SIZE - 1) {
 			return -1;
 		}
-		if (vals_read == 1) {
-			if(key[0] == '~') {
-				//remove may return an error, but is safe to ignore here.
-				remove(key + 1);
-				free(key);
-				key = nullptr;
-			} else {
-				errno = EINVAL;
-				free(key);
-				fclose(fp);
-				return -1;
-			}
-		} else {
-			if (isalpha(value[0])) {
-				chk_succ = insert(key, value);
-			} else {
-				int_val = strtol((char*)value, &endptr, 10);
-				if (value[0] != '\0' && *endptr == '\0') {
-					chk_succ = insert(key, int_val);
-				} else {
-					chk_succ = -1;
-				} 
-			}
-			free(key);
-			key = nullptr;
-			free(value);
-			value = nullptr;
-			if (chk_succ == -1) {
-				fclose(fp);
-				return -1;
+		need = KEY_REST;
+		Policy::step(st, key[i], i);
+	}
+	hashed = Policy::end(st, i);
+	return i == 0 ? -1 : 0;
+}
+
+template<class Policy, class Value>
+int8_t Basic_Hash<Policy, Value>::validate_key(const char* key) {
+	uint64_t hashed;
+	if (scan_key<Policy>((const uint8_t*)key, hashed) == 0) {
+		return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * genHash
+ * @param hashed: set to the key's full hash when not nullptr, which
+ *        find_chain() and the others take instead of hashing again
+ * @return: the key's stripe, -1 if the key is invalid
+ *
+ * Scales the hash into [0, tblSize) with a multiply instead of a
+ * modulo, so -H does not have to be a power of two
+ **/
+template<class Policy, class Value>
+int32_t Basic_Hash<Policy, Value>::genHash(uint8_t *key, uint64_t* hashed)
+{
+	uint64_t value;
+	if (scan_key<Policy>(key, value) == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (hashed != nullptr) {
+		*hashed = value;
+	}
+	return ((__uint128_t)value * tblSize) >> 64;
+}
+
+/**
+ * chain_of
+ * @return: the chain of a key with this hash in a stripe of 1 << level chains
+ **/
+static inline size_t chain_of(uint64_t hashed, uint8_t level)
+{
+	return hashed & (((size_t)1 << level) - 1);
+}
+
+/**
+ * find_chain
+ * @param hash: the key's stripe, from genHash()
+ * @param hashed: the key's full hash, from genHash()
+ * @return: head of the chain that holds, or would hold, the key
+ *
+ * On a growing stripe the key's old chain is moved first, so the key
+ * is only ever in the new chains, then MOVE_STEP more old chains go.
+ * Doubling splits old chain i over new chains i and i + old size.
+ **/
+template<class Policy, class Value>
+typename Basic_Hash<Policy, Value>::Node** Basic_Hash<Policy, Value>::find_chain(int32_t hash, uint64_t hashed)
+{
+	stripe<Value>& st = hTable[hash];
+	if (st.old_chains != nullptr) {
+		move_chain(st, chain_of(hashed, st.level - 1));
+		for (size_t i = 0; i < MOVE_STEP && st.old_chains != nullptr; ++i) {
+			move_chain(st, st.moved++);
+			if (st.moved == (size_t)1 << (st.level - 1)) {
+				retire(st);
 			}
 		}
 	}
-	fclose(fp);
-	return 0;
+	return &st.chains[chain_of(hashed, st.level)];
+}
+
+/**
+ * find_node
+ * @param hash: the key's stripe, from genHash()
+ * @param hashed: the key's full hash, from genHash()
+ * @param key: a valid key
+ * @return: the key's Node, nullptr if it is not in the stripe
+ *
+ * Checks the key's new chain and, while the stripe grows, its old one,
+ * without moving either
+ **/
+template<class Policy, class Value>
+typename Basic_Hash<Policy, Value>::Node* Basic_Hash<Policy, Value>::find_node(int32_t hash, uint64_t hashed, const uint8_t* key)
+{
+	stripe<Value>& st = hTable[hash];
+	Node* current = st.chains[chain_of(hashed, st.level)];
+	for (; current != nullptr; current = current->next) {
+		if (strcmp((char*)current->key, (char*)key) == 0) {
+			return current;
+		}
+	}
+	if (st.old_chains == nullptr) {
+		return nullptr;
+	}
+	current = st.old_chains[chain_of(hashed, st.level - 1)];
+	for (; current != nullptr; current = current->next) {
+		if (strcmp((char*)current->key, (char*)key) == 0) {
+			return current;
+		}
+	}
+	return nullptr;
 }
 
-int8_t Hash::validate_key(const char* key) {
-	if (strlen(key) < DEFAULT_SIZE) {
-		std::regex exp("[a-z][a-z0-9_]*", std::regex_constants::icase);
-		if (std::regex_match(key, exp))	{
+/**
+ * peek
+ * @param hash: the key's stripe, from genHash()
+ * @param hashed: the key's full hash, from genHash()
+ * @param value: set to the key's number on success
+ * @return: 0 if the key holds a number, ENOENT if it is missing, EFAULT
+ *          if it holds a variable, -1 if the stripe can not be peeked
+ *
+ * Numeric lookup that may race with a writer, for callers that check a
+ * sequence count around it and drop results it moved over. The loads
+ * are atomics so none is cached or torn, and the writers store every
+ * field read here the same way. Chain arrays are retired and Nodes stay
+ * in their pool, so every pointer followed is still mapped, but a reused
+ * Node may lead into another chain or round in a circle, hence the
+ * PEEK_STEPS limit. Swiss shards free their slots on a rehash and are
+ * never peeked.
+ **/
+template<class Policy, class Value>
+int Basic_Hash<Policy, Value>::peek(int32_t hash, uint64_t hashed, const uint8_t* key, int64_t& value)
+{
+	typedef uint64_t __attribute__((may_alias)) key_word;
+	const size_t words = Record::KEY_SIZE / sizeof(key_word);
+	if (shards != nullptr) {
+		return -1;
+	}
+	// stored keys are zero padded by store_name, compare them a word at a time
+	key_word padded[words] = {0};
+	memcpy(padded, key, strlen((const char*)key));
+	stripe<Value>& st = hTable[hash];
+	uint8_t level = __atomic_load_n(&st.level, __ATOMIC_ACQUIRE);
+	// acquire, a new chain array may be published after the level
+	Node** chains = __atomic_load_n(&st.chains, __ATOMIC_ACQUIRE);
+	Node** old_chains = __atomic_load_n(&st.old_chains, __ATOMIC_ACQUIRE);
+	// the key's new chain, then while the stripe grows its old one
+	// links are acquires to pair with the release that published the Node
+	Node* heads[2] = {__atomic_load_n(&chains[chain_of(hashed, level)], __ATOMIC_ACQUIRE), nullptr};
+	if (old_chains != nullptr && level > 0) {
+		heads[1] = __atomic_load_n(&old_chains[chain_of(hashed, level - 1)], __ATOMIC_ACQUIRE);
+	}
+	size_t steps = 0;
+	for (Node* current : heads) {
+		for (; current != nullptr; current = __atomic_load_n(&current->next, __ATOMIC_ACQUIRE)) {
+			if (++steps > PEEK_STEPS) {
+				return -1;
+			}
+			const key_word* stored = (const key_word*)current->key;
+			size_t w = 0;
+			while (w < words && __atomic_load_n(&stored[w], __ATOMIC_RELAXED) == padded[w]) {
+				++w;
+			}
+			if (w < words) {
+				continue;
+			}
+			if constexpr (NUMERIC) {
+				value = __atomic_load_n(&current->value, __ATOMIC_RELAXED);
+			} else {
+				if (!__atomic_load_n(&current->value.isNum, __ATOMIC_RELAXED)) {
+					return EFAULT;
+				}
+				value = __atomic_load_n(&current->value.data.num_val, __ATOMIC_RELAXED);
+			}
 			return 0;
 		}
 	}
-	errno = EINVAL;
-	return -1;
+	return ENOENT;
 }
 
 /**
- * This function sourced from
- * http://www.cse.yorku.ca/~oz/hash.html
- * @date 11/23/2020
- */
-int32_t Hash::genHash(uint8_t *key)
+ * move_chain
+ * Moves old chain i of the stripe into the new chains
+ **/
+template<class Policy, class Value>
+void Basic_Hash<Policy, Value>::move_chain(stripe<Value>& st, size_t i)
 {
-	if (validate_key((char*) key) == -1) {
+	Node* current = st.old_chains[i];
+	while (current != nullptr) {
+		Node* temp = current;
+		current = current->next;
+		// the moved Nodes are the only keys hashed again
+		Node** head = &st.chains[chain_of(Policy::hash(temp->key, strlen((const char*)temp->key)), st.level)];
+		__atomic_store_n(&temp->next, *head, __ATOMIC_RELAXED);
+		__atomic_store_n(head, temp, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&st.old_chains[i], nullptr, __ATOMIC_RELAXED);
+}
 
-		return -1;
+/**
+ * grow
+ * Doubles the stripe's chains. Waits for the previous growth to finish
+ * moving, the records keep landing in the new chains meanwhile.
+ **/
+template<class Policy, class Value>
+void Basic_Hash<Policy, Value>::grow(stripe<Value>& st)
+{
+	if (st.old_chains != nullptr || st.level == MAX_LEVEL) {
+		return;
 	}
-	int32_t key_value = 5381;
-	size_t size = strlen((char*)key);
-	for(size_t i = 0; i < size; ++i) {
-		key_value = ((key_value << 5) + key_value) + key[i]; /* hash * 33 + c */;
+	Node** chains = (Node **)calloc((size_t)2 << st.level, sizeof(Node *));
+	if (chains == nullptr) {
+		return;
 	}
-	return floor(tblSize * ((key_value * HASHCONST) - floor(key_value * HASHCONST)));
+	// release, so peek() sees the new array zeroed
+	__atomic_store_n(&st.old_chains, st.chains, __ATOMIC_RELEASE);
+	__atomic_store_n(&st.chains, chains, __ATOMIC_RELEASE);
+	st.moved = 0;
+	// peek() loads the level first, so it never indexes an array
+	// smaller than the level says
+	__atomic_store_n(&st.level, st.level + 1, __ATOMIC_RELEASE);
 }
+
+/**
+ * chain_lengths
+ * @param histogram: histogram[n] is set to the number of chains holding
+ *        n records, the last entry counts every longer chain too
+ * @param size: number of entries in histogram
+ **/
+template<class Policy, class Value>
+void Basic_Hash<Policy, Value>::chain_lengths(size_t* histogram, size_t size)
+{
+	memset(histogram, 0, size * sizeof(size_t));
+	for (size_t i = 0; i < tblSize; ++i) {
+		for (size_t c = 0; c < chain_count(hTable[i]); ++c) {
+			size_t length = 0;
+			for (Node* current = chain_at(hTable[i], c); current != nullptr; current = current->next) {
+				++length;
+			}
+			++histogram[length < size ? length : size - 1];
+		}
+	}
+}
+
+template class Node_Pool<Variant>;
+template class Node_Pool<int64_t>;
+template class Basic_Hash<Djb2_Hash>;
+template class Basic_Hash<Fnv_Hash>;
+template class Basic_Hash<Wy_Hash>;
+template class Basic_Hash<Wy_Hash, int64_t>;
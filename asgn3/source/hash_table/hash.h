@@ -8,39 +8,113 @@
 #ifndef HASHH
 #define HASHH
 
+#include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
-#include <typeinfo>
+#include <type_traits>
 
-class Node { // data class for the hashTable
-	static const size_t MAX_KEY_LENGTH = 32;
+#include "hash_policy.h"
+#include "swiss_table.h"
+
+// data class for the hashTable, the key and value are stored inline
+// like the swiss table's slots
+template<class Value>
+class Basic_Node : public Basic_Slot<Value> {
   public:
-	union data {
-		int64_t num_val;
-		uint8_t* var_val;
-	} data;
-	bool isNum;
-	uint8_t* key;
-	Node *next;
-	template<class dataType>
-	Node (uint8_t*, dataType, bool);
-	~Node();
+	Basic_Node *next;
 };
 
-class Hash
+/**
+ * Node_Pool
+ * Free list of Nodes carved out of slabs. Each bucket has its own pool,
+ * so the bucket lock SyncHash holds covers it. Slabs are only freed with
+ * the pool.
+ **/
+template<class Value>
+class Node_Pool
 {
   public:
+	typedef Basic_Node<Value> Node;
+	static const size_t SLAB_NODES = 32;
+	Node_Pool() : free_list(nullptr), slabs(nullptr) {}
+	~Node_Pool();
+	Node* alloc();
+	void release(Node* node)
+	{
+		// SyncHash's optimistic lookups may still be walking the Node
+		__atomic_store_n(&node->next, free_list, __ATOMIC_RELAXED);
+		free_list = node;
+	}
+
+  private:
+	struct slab {
+		slab* next;
+		Node nodes[SLAB_NODES];
+	};
+	Node* free_list;
+	slab* slabs;
+};
+
+// chain arrays a stripe has replaced, kept until the table is deleted
+// since SyncHash's optimistic lookups may still be walking them
+struct retired_chains {
+	retired_chains* next;
+	void* chains;
+};
+
+/**
+ * stripe
+ * Chains of one bucket, the unit SyncHash locks. The chains double once
+ * they average GROW_LOAD records, and the old chains move over a few at
+ * a time by later inserts and removes on the stripe, so growing never
+ * stalls it. Until then a record can be in either array. Lookups never
+ * move chains, so they only read the stripe.
+ **/
+template<class Value>
+struct stripe {
+	Basic_Node<Value>** chains;
+	// 1 << (level - 1) chains still being moved, nullptr when none
+	Basic_Node<Value>** old_chains;
+	size_t moved;
+	size_t count;
+	retired_chains* retired;
+	uint8_t level;
+};
+
+/**
+ * Basic_Hash
+ * @param Policy: 64 bit key hash, see hash_policy.h. The high bits pick
+ *        the stripe and the low bits the chain within it.
+ * @param Value: Variant, or int64_t for a table of numbers only. The
+ *        numeric table has no tag to check and rejects variable values.
+ **/
+template<class Policy, class Value = Variant>
+class Basic_Hash
+{
+  public:
+	typedef Value Value_Type;
+	static constexpr bool NUMERIC = std::is_same<Value, int64_t>::value;
+	// how each bucket stores its records
+	enum Backend { CHAINED, SWISS };
 	static const size_t DEFAULT_SIZE = 32;
 	static const uint16_t DEFAULT_RECUR = 50;
-	static constexpr double HASHCONST = .618034;
+	// average chain length that doubles a stripe's chains
+	static const size_t GROW_LOAD = 4;
+	// old chains moved by every operation on a growing stripe
+	static const size_t MOVE_STEP = 2;
+	static const uint8_t MAX_LEVEL = 24;
+	// Nodes a peek() walks before assuming a writer sent it in circles
+	static const size_t PEEK_STEPS = 64;
 	static constexpr char* DEFAULT_LOG_DIR = (char*)"data";
 	static constexpr char* LOGFILE = (char*)"logfile.log";
-	Hash() : Hash(DEFAULT_SIZE){};
-	Hash(size_t size, uint16_t recur = DEFAULT_RECUR, char* _logdir = DEFAULT_LOG_DIR);
-	~Hash();
+	Basic_Hash() : Basic_Hash(DEFAULT_SIZE){};
+	Basic_Hash(size_t size, uint16_t recur = DEFAULT_RECUR, char* _logdir = DEFAULT_LOG_DIR,
+	  Backend backend = CHAINED);
+	~Basic_Hash();
 	template<class dataType>
 	int8_t insert(uint8_t *, dataType);
 	int8_t remove(uint8_t *);
@@ -52,106 +126,307 @@ class Hash
 	int8_t dump(const char *);
 	int8_t load(const char *);
 	size_t size() { return tblSize; }
+	void chain_lengths(size_t*, size_t);
 
   protected:
+	typedef Basic_Node<Value> Node;
+	typedef Basic_Slot<Value> Record;
 	bool init_load;
 	int log_dir;
 	FILE* logfile;
-	Node **hTable;
+	stripe<Value> *hTable;
+	Node_Pool<Value> *pools;
+	// one open addressing table per bucket, nullptr when chained
+	Basic_Swiss_Table<Value> *shards;
 	size_t tblSize;
 	uint16_t recur_amt;
 	int8_t validate_key(const char*);
-	int32_t genHash(uint8_t *);
+	int32_t genHash(uint8_t *, uint64_t* hashed = nullptr);
+	Node** find_chain(int32_t, uint64_t);
+	Node* find_node(int32_t, uint64_t, const uint8_t*);
+	void move_chain(stripe<Value>&, size_t);
+	void grow(stripe<Value>&);
+	// the int32_t/uint64_t pairs below are the stripe and the full hash
+	// genHash() gave, so each key is only hashed once
+	template<class dataType>
+	int8_t insert(int32_t, uint64_t, uint8_t *, dataType);
+	int8_t remove(int32_t, uint64_t, uint8_t *);
+	int8_t lookup(int32_t, uint64_t, uint8_t*, const Value*&);
+	int8_t lookup(int32_t, uint64_t, uint8_t*, int64_t&);
+	int8_t lookup(int32_t, uint64_t, uint8_t*, uint8_t*&);
+	int peek(int32_t, uint64_t, const uint8_t*, int64_t&);
 	template<class dataType>
-	int8_t insert(int32_t, uint8_t *, dataType);
-	int8_t remove(int32_t, uint8_t *);
-	int8_t lookup(int32_t, uint8_t*, Node*&);
+	void log_insert(const uint8_t*, dataType);
+	void log_remove(const uint8_t* key)
+	{
+		if (!init_load) {
+			fprintf(logfile, "~%s=\n", key);
+			sync_log();
+		}
+	}
+	int8_t write_record(int, const uint8_t*, const Value&);
+	template<class Visit>
+	int8_t visit(Visit);
+	void reset();
+	void truncate_log();
+	template<class Insert, class Remove>
+	static int8_t read_records(FILE*, Insert, Remove);
 	int8_t load(FILE*);
 	void load_dump();
 	void sync_log() { fflush(logfile); }
 };
 
+typedef Basic_Hash<Wy_Hash> Hash;
+typedef Basic_Hash<Wy_Hash, int64_t> Num_Hash;
+
+/**
+ * chain_count
+ * @return: number of chains in the stripe, old ones included
+ **/
+template<class Value>
+static inline size_t chain_count(const stripe<Value>& st)
+{
+	return ((size_t)1 << st.level) + (st.old_chains != nullptr ? (size_t)1 << (st.level - 1) : 0);
+}
+
+/**
+ * chain_at
+ * @return: chain c of the stripe, the old chains follow the new ones
+ **/
+template<class Value>
+static inline Basic_Node<Value>*& chain_at(stripe<Value>& st, size_t c)
+{
+	size_t chains = (size_t)1 << st.level;
+	return c < chains ? st.chains[c] : st.old_chains[c - chains];
+}
+
+/**
+ * store_name
+ * @param dest: Variant::NAME_SIZE bytes of a key or variable name
+ * @param name: null terminated name, cut short to fit
+ *
+ * Stores the zero padded name a word at a time with relaxed atomics,
+ * the same words SyncHash's optimistic lookups read while it changes.
+ **/
+static inline void store_name(uint8_t* dest, const uint8_t* name)
+{
+	typedef uint64_t __attribute__((may_alias)) name_word;
+	name_word padded[Variant::NAME_SIZE / sizeof(name_word)] = {0};
+	strncpy((char*)padded, (const char*)name, Variant::NAME_SIZE - 1);
+	for (size_t w = 0; w < Variant::NAME_SIZE / sizeof(name_word); ++w) {
+		__atomic_store_n((name_word*)dest + w, padded[w], __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * store
+ * Copies a value into a record of either backend, with relaxed atomic
+ * stores for the optimistic lookups
+ **/
+template<class dataType>
+static inline void store(int64_t& record, dataType value)
+{
+	__atomic_store_n(&record, value, __ATOMIC_RELAXED);
+}
+
 template<class dataType>
-Node::Node (uint8_t* nKey, dataType val, bool isNum) {
-    key = (uint8_t*) calloc(MAX_KEY_LENGTH, sizeof(uint8_t));
-	strcpy((char*)key, (char *)nKey);
-	this->isNum = isNum;
-	this->next = nullptr;
-	if (isNum) {
-	    data.num_val = (int64_t)val;
+static inline void store(Variant& record, dataType value)
+{
+	__atomic_store_n(&record.isNum, std::is_same<dataType, int64_t>::value, __ATOMIC_RELAXED);
+	if constexpr (std::is_same<dataType, int64_t>::value) {
+		__atomic_store_n(&record.data.num_val, value, __ATOMIC_RELAXED);
 	} else {
-	    data.var_val = (uint8_t*) calloc(MAX_KEY_LENGTH, sizeof(uint8_t));
-		strcpy((char*)data.var_val, (char *)val);
+		store_name(record.data.var_val, (const uint8_t*)value);
 	}
 }
 
 /**
  * Insert
  * @param key: The key to be inserted into the hashtable
- * @param value: Signed integer value associated to key
+ * @param value: Signed integer value, or the name of another variable,
+ *        associated to key
  *
  * Hashes the key and uses the hash value to insert
  * a new node into the table. Replaces an already
- * existing Node
+ * existing Node. A numeric table fails with EINVAL on a variable name.
  **/
+template<class Policy, class Value>
 template<class dataType>
-int8_t Hash::insert(uint8_t* key, dataType value)
+int8_t Basic_Hash<Policy, Value>::insert(uint8_t* key, dataType value)
 {
-	int32_t hash = genHash(key);
-	if (hash == -1) {
+	constexpr bool isNum = std::is_same<dataType, int64_t>::value;
+	if constexpr (NUMERIC && !isNum) {
+		errno = EINVAL;
 		return -1;
-	}
-	if (insert<dataType>(hash, key, value) == 0) {
-		if(!init_load) {
-			if (typeid(dataType) == typeid(int64_t)) {
-				fprintf(logfile, "%s=%ld\n", key, (int64_t)value);
-			} else {
-				fprintf(logfile, "%s=%s\n", key, (char*)value);
-			}
-			sync_log();
+	} else {
+		uint64_t hashed;
+		int32_t hash = genHash(key, &hashed);
+		if (hash == -1 || insert<dataType>(hash, hashed, key, value) == -1) {
+			return -1;
 		}
+		log_insert(key, value);
 		return 0;
 	}
-	return -1;
 }
 
+/**
+ * log_insert
+ * Appends key=value to the log, unless the log itself is being replayed
+ **/
+template<class Policy, class Value>
+template<class dataType>
+void Basic_Hash<Policy, Value>::log_insert(const uint8_t* key, dataType value)
+{
+	if(!init_load) {
+		if constexpr (std::is_same<dataType, int64_t>::value) {
+			fprintf(logfile, "%s=%ld\n", key, value);
+		} else {
+			fprintf(logfile, "%s=%s\n", key, (char*)value);
+		}
+		sync_log();
+	}
+}
+
+template<class Policy, class Value>
 template<class dataType>
-int8_t Hash::insert(int32_t hash, uint8_t* key, dataType value)
+int8_t Basic_Hash<Policy, Value>::insert(int32_t hash, uint64_t hashed, uint8_t* key, dataType value)
 {
-	Node* current = hTable[hash];
-	Node* prev = hTable[hash];
-	bool isNum = typeid(int64_t) == typeid(value);
+	constexpr bool isNum = std::is_same<dataType, int64_t>::value;
+	if (shards != nullptr) {
+		Record* slot = shards[hash].find(key);
+		if (slot == nullptr) {
+			if (!isNum && validate_key((char*)value) != 0) {
+				errno = EINVAL;
+				return -1;
+			}
+			slot = shards[hash].insert(key);
+		}
+		store(slot->value, value);
+		return 0;
+	}
+	Node** head = find_chain(hash, hashed);
+	Node* current = *head;
+	Node* prev = *head;
 	while(current != nullptr) {
 		if (strcmp((char*)current->key, (char*)key) == 0) {
-			if (!current->isNum) {
-				free(current->data.var_val);
-			}
-			if (isNum) {
-				current->data.num_val = (int64_t)value;
-			} else {
-				current->data.var_val = (uint8_t*) calloc(DEFAULT_SIZE, sizeof(uint8_t));
-				strcpy((char*)current->data.var_val, (char *)value);
-			}
-			current->isNum = isNum;
+			store(current->value, value);
 			return 0;
 		}
 		prev = current;
 		current = current->next;
 	}
-	Node* newNode;
-	if (isNum) { 
-		newNode = new Node(key, value, true);
-	} else if (validate_key((char*)value) == 0) {
-		newNode = new Node(key, value, false);
-	} else {
+	if (!isNum && validate_key((char*)value) != 0) {
 		errno = EINVAL;
 		return -1;
-	} 
+	}
+	// a reused Node may still be read by an optimistic lookup, and the
+	// link is a release so one that follows it sees the Node filled in
+	Node* newNode = pools[hash].alloc();
+	store_name(newNode->key, key);
+	__atomic_store_n(&newNode->next, nullptr, __ATOMIC_RELAXED);
+	store(newNode->value, value);
 	if (prev == current) {
-		hTable[hash] = newNode;
+		__atomic_store_n(head, newNode, __ATOMIC_RELEASE);
 	} else {
-		prev->next = newNode;
+		__atomic_store_n(&prev->next, newNode, __ATOMIC_RELEASE);
+	}
+	stripe<Value>& st = hTable[hash];
+	if (++st.count > GROW_LOAD << st.level) {
+		grow(st);
+	}
+	return 0;
+}
+
+/**
+ * visit
+ * @param fn: called as fn(key, value) on every record, returning -1 stops
+ *        the walk
+ * @return: 0 once every record was visited, -1 if fn stopped it
+ **/
+template<class Policy, class Value>
+template<class Visit>
+int8_t Basic_Hash<Policy, Value>::visit(Visit fn)
+{
+	for (size_t i = 0; i < tblSize; ++i) {
+		if (shards != nullptr) {
+			size_t pos = 0;
+			Record* slot;
+			while ((slot = shards[i].next(pos)) != nullptr) {
+				if (fn(slot->key, slot->value) == -1) {
+					return -1;
+				}
+			}
+		}
+		for (size_t c = 0; c < chain_count(hTable[i]); ++c) {
+			for (Node* current = chain_at(hTable[i], c); current != nullptr; current = current->next) {
+				if (fn(current->key, current->value) == -1) {
+					return -1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * read_records
+ * @param fp: '=' seperated key-value lines, closed before returning
+ * @param insert: called as insert(key, int64_t) or insert(key, uint8_t*)
+ * @param remove: called as remove(key) for lines preceeded by a `~`
+ * @return: 0 if every line parsed and inserted, -1 otherwise. Sets errno
+ *
+ * Shared by the table's own load and SyncHash's lock-free table
+ **/
+template<class Policy, class Value>
+template<class Insert, class Remove>
+int8_t Basic_Hash<Policy, Value>::read_records(FILE* fp, Insert insert, Remove remove) {
+	uint8_t* key = nullptr;
+	uint8_t* value = nullptr;
+	char* endptr;
+	int64_t int_val;
+	int8_t chk_succ = 0;
+	int vals_read;
+
+	while ((vals_read = fscanf(fp," %m[^=]=%m[^\n]",&key,&value)) != EOF) {
+		if(vals_read == 0) {
+			errno = EINVAL;
+			fclose(fp);
+			return -1;
+		}
+		if (vals_read == 1) {
+			if(key[0] == '~') {
+				//remove may return an error, but is safe to ignore here.
+				remove(key + 1);
+				free(key);
+				key = nullptr;
+			} else {
+				errno = EINVAL;
+				free(key);
+				fclose(fp);
+				return -1;
+			}
+		} else {
+			if (isalpha(value[0])) {
+				chk_succ = insert(key, value);
+			} else {
+				int_val = strtol((char*)value, &endptr, 10);
+				if (value[0] != '\0' && *endptr == '\0') {
+					chk_succ = insert(key, int_val);
+				} else {
+					chk_succ = -1;
+				} 
+			}
+			free(key);
+			key = nullptr;
+			free(value);
+			value = nullptr;
+			if (chk_succ == -1) {
+				fclose(fp);
+				return -1;
+			}
+		}
 	}
+	fclose(fp);
 	return 0;
 }
 
@@ -0,0 +1,124 @@
+/**
+ * Hash backend benchmark
+ *
+ * Fills a chained and a swiss table with the same keys and reports the
+ * cost of inserts, hits, misses and remove/insert pairs on each, for
+ * the variant table and the numeric only one. Bucket indices are
+ * computed up front and the bucket level calls are timed, so key
+ * validation and the log stay out of the numbers.
+ *
+ * usage: ./hash_bench [keys] [buckets] [lookups]
+ *
+ * @author Perry David Ralston Jr
+ * @date 12/15/2020
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "hash.h"
+
+struct result {
+	double insert;
+	double hit;
+	double miss;
+	double replace;
+};
+
+struct key_set {
+	uint8_t (*keys)[Hash::DEFAULT_SIZE];
+	int32_t *hashes;
+	uint64_t *full;
+	int64_t count;
+};
+
+template<class Table>
+key_set make_keys(Bench_Hash<Table> *table, char prefix, int64_t count)
+{
+	key_set set;
+	set.keys = (uint8_t(*)[Hash::DEFAULT_SIZE])calloc(count, Hash::DEFAULT_SIZE);
+	set.hashes = (int32_t *)calloc(count, sizeof(int32_t));
+	set.full = (uint64_t *)calloc(count, sizeof(uint64_t));
+	set.count = count;
+	for(int64_t i = 0; i < count; ++i) {
+		snprintf((char *)set.keys[i], Hash::DEFAULT_SIZE, "%c%ld", prefix, i);
+		set.hashes[i] = table->bucket(set.keys[i], set.full[i]);
+	}
+	return set;
+}
+
+/**
+ * bench
+ * @return: nanoseconds per operation of each phase
+ **/
+template<class Table>
+result bench(typename Table::Backend backend, char *log_dir, int64_t keys, size_t buckets,
+  int64_t lookups)
+{
+	int64_t found, sum = 0;
+	result res;
+	Bench_Hash<Table> *table = new Bench_Hash<Table>(buckets, Hash::DEFAULT_RECUR, log_dir, backend);
+	key_set present = make_keys(table, 'k', keys);
+	key_set missing = make_keys(table, 'm', keys);
+	double begin = now();
+	for(int64_t i = 0; i < keys; ++i) {
+		table->insert(present.hashes[i], present.full[i], present.keys[i], i);
+	}
+	res.insert = (now() - begin) * 1e9 / keys;
+	uint32_t seed = 1, pick;
+	begin = now();
+	for(int64_t i = 0; i < lookups; ++i) {
+		seed = seed * 1103515245 + 12345;
+		pick = (seed >> 8) % keys;
+		if(table->find(present.hashes[pick], present.full[pick], present.keys[pick], found) == 0)
+			sum += found;
+	}
+	res.hit = (now() - begin) * 1e9 / lookups;
+	begin = now();
+	for(int64_t i = 0; i < lookups; ++i) {
+		seed = seed * 1103515245 + 12345;
+		pick = (seed >> 8) % keys;
+		if(table->find(missing.hashes[pick], missing.full[pick], missing.keys[pick], found) == 0)
+			sum += found;
+	}
+	res.miss = (now() - begin) * 1e9 / lookups;
+	begin = now();
+	for(int64_t i = 0; i < lookups; ++i) {
+		seed = seed * 1103515245 + 12345;
+		pick = (seed >> 8) % keys;
+		table->erase(present.hashes[pick], present.full[pick], present.keys[pick]);
+		table->insert(present.hashes[pick], present.full[pick], present.keys[pick], i);
+	}
+	res.replace = (now() - begin) * 1e9 / lookups;
+	if(sum == 0)
+		printf("unexpected sum\n");
+	delete table;
+	free(present.keys);
+	free(present.hashes);
+	free(present.full);
+	free(missing.keys);
+	free(missing.hashes);
+	free(missing.full);
+	return res;
+}
+
+void print(const char *name, result res)
+{
+	printf("%8s %12.1f %12.1f %12.1f %12.1f\n", name, res.insert, res.hit, res.miss, res.replace);
+}
+
+int main(int argc, char *argv[])
+{
+	int64_t keys = argc > 1 ? atol(argv[1]) : 20000;
+	size_t buckets = argc > 2 ? atol(argv[2]) : Hash::DEFAULT_SIZE;
+	int64_t lookups = argc > 3 ? atol(argv[3]) : 1000000;
+	Log_Dir log_dir("hash_bench");
+	printf("%ld keys, %zu buckets\n", keys, buckets);
+	printf("%8s %12s %12s %12s %12s\n", "(ns/op)", "insert", "hit", "miss", "replace");
+	print("chained", bench<Hash>(Hash::CHAINED, log_dir.path, keys, buckets, lookups));
+	print("swiss", bench<Hash>(Hash::SWISS, log_dir.path, keys, buckets, lookups));
+	print("num/ch", bench<Num_Hash>(Num_Hash::CHAINED, log_dir.path, keys, buckets, lookups));
+	print("num/sw", bench<Num_Hash>(Num_Hash::SWISS, log_dir.path, keys, buckets, lookups));
+	return 0;
+}
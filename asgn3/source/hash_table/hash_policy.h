@@ -0,0 +1,130 @@
+/**
+ * Hash policies
+ * 64 bit key hashes for Basic_Hash. A policy takes a key one byte at a
+ * time: begin() sets up its state, step() adds the byte at an index and
+ * end() gives the hash of a key of that length. Basic_Hash drives them
+ * from the loop that validates the key, so each key is read once.
+ * hash(key, length) runs the same steps over a key already known valid.
+ * Keys are at most 31 bytes, so each policy only needs to be quick on
+ * short keys.
+ *
+ * @author Perry David Ralston Jr.
+ * @date 12/17/2020
+ */
+#ifndef HASH_POLICY
+#define HASH_POLICY
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+/**
+ * run_steps
+ * @return: the policy's hash of a key of length bytes
+ **/
+template<class Policy>
+static inline uint64_t run_steps(const uint8_t* key, size_t length)
+{
+	typename Policy::state st;
+	Policy::begin(st);
+	for (size_t i = 0; i < length; ++i) {
+		Policy::step(st, key[i], i);
+	}
+	return Policy::end(st, length);
+}
+
+/**
+ * Djb2_Hash
+ * The table's original hash, kept to compare against
+ * http://www.cse.yorku.ca/~oz/hash.html
+ **/
+struct Djb2_Hash {
+	static constexpr const char* NAME = "djb2";
+	typedef uint64_t state;
+	static inline void begin(state& st) { st = 5381; }
+	static inline void step(state& st, uint8_t c, size_t)
+	{
+		st = ((st << 5) + st) + c; /* hash * 33 + c */
+	}
+	static inline uint64_t end(state& st, size_t) { return st; }
+	static inline uint64_t hash(const uint8_t* key, size_t length)
+	{
+		return run_steps<Djb2_Hash>(key, length);
+	}
+};
+
+/**
+ * Fnv_Hash
+ * FNV-1a, one multiply per byte
+ **/
+struct Fnv_Hash {
+	static constexpr const char* NAME = "fnv1a";
+	typedef uint64_t state;
+	static inline void begin(state& st) { st = 0xcbf29ce484222325ull; }
+	static inline void step(state& st, uint8_t c, size_t)
+	{
+		st = (st ^ c) * 0x100000001b3ull;
+	}
+	static inline uint64_t end(state& st, size_t) { return st; }
+	static inline uint64_t hash(const uint8_t* key, size_t length)
+	{
+		return run_steps<Fnv_Hash>(key, length);
+	}
+};
+
+/**
+ * Wy_Hash
+ * wyhash style: 16 bytes at a time folded in with a 64x64->128 bit
+ * multiply, so a key of up to 31 bytes costs three multiplies. The
+ * bytes are gathered little endian into the two words as they arrive,
+ * and the length only joins in the last multiply.
+ **/
+struct Wy_Hash {
+	static constexpr const char* NAME = "wyhash";
+	static const uint64_t P0 = 0xa0761d6478bd642full;
+	static const uint64_t P1 = 0xe7037ed1a0b428dbull;
+	static const uint64_t P2 = 0x8ebc6af09c88c6e3ull;
+	struct state {
+		uint64_t seed;
+		// first word of the block once it is full, and the word being filled
+		uint64_t low;
+		uint64_t word;
+	};
+	static inline uint64_t mum(uint64_t a, uint64_t b)
+	{
+		__uint128_t product = (__uint128_t)a * b;
+		return (uint64_t)product ^ (uint64_t)(product >> 64);
+	}
+	static inline void begin(state& st)
+	{
+		st.seed = P0;
+		st.low = st.word = 0;
+	}
+	static inline void step(state& st, uint8_t c, size_t i)
+	{
+		st.word |= (uint64_t)c << ((i & 7) * 8);
+		if ((i & 7) == 7) {
+			if (i & 8) {
+				st.seed = mum(st.low ^ P1, st.word ^ st.seed);
+				st.low = 0;
+			} else {
+				st.low = st.word;
+			}
+			st.word = 0;
+		}
+	}
+	static inline uint64_t end(state& st, size_t length)
+	{
+		if ((length & 15) > 8) {
+			st.seed = mum(st.low ^ P1, st.word ^ st.seed);
+		} else if ((length & 15) != 0) {
+			st.seed = mum(((length & 15) == 8 ? st.low : st.word) ^ P1, st.seed);
+		}
+		return mum(st.seed ^ P2, length ^ P1);
+	}
+	static inline uint64_t hash(const uint8_t* key, size_t length)
+	{
+		return run_steps<Wy_Hash>(key, length);
+	}
+};
+
+#endif
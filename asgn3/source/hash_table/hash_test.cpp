@@ -18,7 +18,7 @@
 #include "hash.h"
 
 //Constants//
-static const size_t TESTCOUNT = 18;
+static const size_t TESTCOUNT = 20;
 static const int8_t KEY_SIZE = 32;
 
 //Test Functions//
@@ -40,6 +40,8 @@ void testInitLoad(Hash*);
 void testInitLoadWithVars(Hash*);
 void testInitLoadWithRemoves(Hash*);
 void testPersistance(Hash*);
+void testGrowth(Hash*);
+void testNumericTable(Hash*);
 
 //Data//
 uint8_t key1[] = "foo",
@@ -55,6 +57,7 @@ int64_t val1,
 		val3,
 		result, 
 		read_value;
+Hash::Backend backend;
 std::ifstream in_gen;
 std::string outfile, line;
 enum class keys { key1, key2, key3 };
@@ -62,6 +65,7 @@ struct stat file_stats;
 
 //Supporting Functions//
 keys hash_switch(uint8_t*);
+Hash* new_hash(size_t);
 
 
 int main(){
@@ -83,12 +87,19 @@ int main(){
 	testInitLoad,
 	testInitLoadWithVars,
 	testInitLoadWithRemoves,
-	testPersistance
+	testPersistance,
+	testGrowth,
+	testNumericTable
   };
   
+  //every test runs against both bucket backends
+  const Hash::Backend backends[] = {Hash::CHAINED, Hash::SWISS};
+  for(Hash::Backend curr : backends) {
+  backend = curr;
+  printf("-----%s backend:-----\n", backend == Hash::CHAINED ? "Chained" : "Swiss");
   for(size_t i = 0; i < TESTCOUNT; i++) {
     //before:
-    Hash* H = new Hash();
+    Hash* H = new_hash(Hash::DEFAULT_SIZE);
 	val1 = 42;
 	val2 = -42;
 	val3 = 128;
@@ -107,10 +118,15 @@ int main(){
 	free(key);
 	free(var_result);
   }
+  }
   printf("All tests passed successfully\n");
   return 0;
 }
 
+Hash* new_hash(size_t size) {
+	return new Hash(size, Hash::DEFAULT_RECUR, Hash::DEFAULT_LOG_DIR, backend);
+}
+
 keys hash_switch(uint8_t* in_str) {
 	if (strcmp((char*)in_str, (char*)key1) == 0) {
 		return keys::key1;
@@ -133,7 +149,7 @@ void testNewHash(Hash* H) {
 void testNewHashWithZeroArg(Hash* H) {
 	printf("TestNewHashWithZeroArg: ");
 	size_t size = 0;
-	H = new Hash(size);
+	H = new_hash(size);
 	assert(H->size() == Hash::DEFAULT_SIZE);
 	delete(H);
 	printf("Passed\n");
@@ -142,7 +158,7 @@ void testNewHashWithZeroArg(Hash* H) {
 void testNewHashWithNonZeroArg(Hash* H) {
 	printf("TestNewHashWithNonZeroArg: ");
 	size_t size = 100;
-	H = new Hash(size);
+	H = new_hash(size);
 	assert(H->size() == size);
 	delete(H);
 	printf("Passed\n");
@@ -154,7 +170,7 @@ void testInsert(Hash* H) {
 	assert(H->insert(badname, val1) == -1);
 	assert(H->insert(invalidName, val1) == -1);
 	assert(H->insert(invalidName_2, val1) == -1);
-	H = new Hash(1);
+	H = new_hash(1);
 	assert(H->insert(key1, val1) != -1);
 	assert(H->insert(key2, val2) != -1);
 	delete(H);
@@ -170,7 +186,7 @@ void testLookup(Hash* H) {
 	assert(H->lookup(badname, result) == -1);
 	assert(H->lookup(invalidName, result) == -1);
 	assert(H->lookup(invalidName_2, result) == -1);
-	H = new Hash(1);
+	H = new_hash(1);
 	H->insert(key1, val1);
 	assert(H->lookup(key1, result) == 0);
 	assert(result == val1);
@@ -319,7 +335,7 @@ void testRecursiveLookUpTooManyLookUps(Hash* H) {
 void testInitLoad(Hash* H) {
 	printf("TestInitLoad: ");
 	std::system("cp data/sample_in.txt data/logfile.log");
-	H = new Hash();
+	H = new_hash(Hash::DEFAULT_SIZE);
 	assert(H->lookup(key1, result) == 0);
 	assert(result == val1);
 	assert(H->lookup(key2, result) == 0);
@@ -333,7 +349,7 @@ void testInitLoad(Hash* H) {
 void testInitLoadWithVars(Hash* H) {
 	printf("testInitLoadWithVars: ");
 	std::system("cp data/input_with_vars.txt data/logfile.log");
-	H = new Hash();
+	H = new_hash(Hash::DEFAULT_SIZE);
 	assert(H->lookup(key1, result) == 0);
 	assert(result == val1);
 	assert(H->lookup(key2, var_result) == 0);
@@ -347,7 +363,7 @@ void testInitLoadWithVars(Hash* H) {
 void testInitLoadWithRemoves(Hash* H) {
 	printf("testInitLoadWithRemoves: ");
 	std::system("cp data/input_with_removes.txt data/logfile.log");
-	H = new Hash();
+	H = new_hash(Hash::DEFAULT_SIZE);
 	assert(H->lookup(key1, result) == -1);
 	assert(H->lookup(key3, result) == 0);
 	assert(result == val3);
@@ -361,7 +377,7 @@ void testPersistance(Hash* H) {
 	H->insert(key2, val2);
 	H->insert(key3, val3);
 	H->insert(key3, key1);
-	H = new Hash();
+	H = new_hash(Hash::DEFAULT_SIZE);
 	assert(H->lookup(key1, result) == 0);
 	assert(result = val1);
 	assert(H->lookup(key2, result) == 0);
@@ -375,3 +391,66 @@ void testPersistance(Hash* H) {
 }
 
 
+
+void testGrowth(Hash* H) {
+	printf("testGrowth: ");
+	const int64_t count = 5000;
+	H = new_hash(1);
+	for (int64_t i = 0; i < count; ++i) {
+		snprintf((char*)key, KEY_SIZE, "k%ld", i);
+		assert(H->insert(key, i) == 0);
+	}
+	//half way through moving, every key must still be found
+	for (int64_t i = 0; i < count; i += 2) {
+		snprintf((char*)key, KEY_SIZE, "k%ld", i);
+		assert(H->remove(key) == 0);
+	}
+	for (int64_t i = 0; i < count; ++i) {
+		snprintf((char*)key, KEY_SIZE, "k%ld", i);
+		if (i % 2 == 0) {
+			assert(H->lookup(key, result) == -1);
+		} else {
+			assert(H->lookup(key, result) == 0);
+			assert(result == i);
+		}
+	}
+	outfile = "outfile.txt";
+	assert(H->dump(outfile.c_str()) == 0);
+	in_gen.open(outfile);
+	int64_t lines = 0;
+	while (getline(in_gen, line)) {
+		++lines;
+	}
+	in_gen.close();
+	assert(lines == count / 2);
+	if (remove(outfile.c_str()) == -1) {
+		warn("Unable to delete %s: %s", outfile.c_str(), strerror(errno));
+	}
+	delete(H);
+	printf("Passed\n");
+}
+
+void testNumericTable(Hash*) {
+	printf("testNumericTable: ");
+	Num_Hash* N = new Num_Hash(Hash::DEFAULT_SIZE, Hash::DEFAULT_RECUR, Hash::DEFAULT_LOG_DIR,
+	  backend == Hash::CHAINED ? Num_Hash::CHAINED : Num_Hash::SWISS);
+	assert(N->insert(key1, val1) == 0);
+	assert(N->insert(key2, val2) == 0);
+	assert(N->insert(key3, key1) == -1);
+	assert(errno == EINVAL);
+	assert(N->lookup(key3, result) == -1);
+	assert(N->lookup(key1, var_result) == -1);
+	assert(errno == EFAULT);
+	assert(N->rlookup(key2, result, N->get_recur_amt()) == 0);
+	assert(result == val2);
+	assert(N->remove(key2) == 0);
+	//deleting a table clears its log, so reopen it first
+	Num_Hash* reopened = new Num_Hash(Hash::DEFAULT_SIZE, Hash::DEFAULT_RECUR, Hash::DEFAULT_LOG_DIR,
+	  backend == Hash::CHAINED ? Num_Hash::CHAINED : Num_Hash::SWISS);
+	assert(reopened->lookup(key1, result) == 0);
+	assert(result == val1);
+	assert(reopened->lookup(key2, result) == -1);
+	delete(reopened);
+	delete(N);
+	printf("Passed\n");
+}
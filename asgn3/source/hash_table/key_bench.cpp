@@ -0,0 +1,90 @@
+/**
+ * Key validation and hashing benchmark
+ *
+ * Times the per-key cost of genHash() against the original version,
+ * which matched every key against a freshly built std::regex before
+ * hashing it with djb2. Half the keys are invalid.
+ *
+ * usage: ./key_bench [keys]
+ *
+ * @author Perry David Ralston Jr
+ * @date 12/16/2020
+ */
+
+#include <cmath>
+#include <err.h>
+#include <regex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "hash.h"
+
+static const size_t CORPUS_SIZE = 64;
+static constexpr double HASHCONST = .618034;
+
+/*----------previous version --------------*/
+
+int8_t old_validate_key(const char *key)
+{
+	if(strlen(key) < Hash::DEFAULT_SIZE) {
+		std::regex exp("[a-z][a-z0-9_]*", std::regex_constants::icase);
+		if(std::regex_match(key, exp)) {
+			return 0;
+		}
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+int32_t old_gen_hash(uint8_t *key, size_t tbl_size)
+{
+	if(old_validate_key((char *)key) == -1) {
+		return -1;
+	}
+	uint32_t key_value = 5381;
+	size_t size = strlen((char *)key);
+	for(size_t i = 0; i < size; ++i) {
+		key_value = ((key_value << 5) + key_value) + key[i];
+	}
+	int32_t signed_value = (int32_t)key_value;
+	return floor(tbl_size * ((signed_value * HASHCONST) - floor(signed_value * HASHCONST)));
+}
+
+int main(int argc, char *argv[])
+{
+	int64_t keys = argc > 1 ? atol(argv[1]) : 100000;
+	Log_Dir log_dir("key_bench");
+	Bench_Hash<Hash> *table = new Bench_Hash<Hash>(Hash::DEFAULT_SIZE, Hash::DEFAULT_RECUR, log_dir.path);
+	const char *invalid[] = {"5oobar", "foo~bar", "",
+	  "this_is_a_really_really_bad_name_and_it_should_not_be_allowed"};
+	uint8_t corpus[CORPUS_SIZE][Hash::DEFAULT_SIZE + 32];
+	for(size_t i = 0; i < CORPUS_SIZE; ++i) {
+		if(i % 2 == 0) {
+			snprintf((char *)corpus[i], sizeof(corpus[i]), "var_%zu_%s", i, i % 4 == 0 ? "x" : "total");
+		} else {
+			snprintf((char *)corpus[i], sizeof(corpus[i]), "%s", invalid[i / 2 % 4]);
+		}
+		if((old_gen_hash(corpus[i], Hash::DEFAULT_SIZE) == -1) != (table->bucket(corpus[i]) == -1))
+			errx(2, "%s: validation differs", corpus[i]);
+	}
+	int64_t sum = 0;
+	double begin = now();
+	for(int64_t i = 0; i < keys; ++i) {
+		sum += old_gen_hash(corpus[i % CORPUS_SIZE], Hash::DEFAULT_SIZE);
+	}
+	double before = (now() - begin) * 1e9 / keys;
+	begin = now();
+	for(int64_t i = 0; i < keys; ++i) {
+		sum += table->bucket(corpus[i % CORPUS_SIZE]);
+	}
+	double after = (now() - begin) * 1e9 / keys;
+	if(sum == 0)
+		printf("unexpected sum\n");
+	printf("%12s %12s\n", "(ns/key)", "genHash");
+	printf("%12s %12.1f\n", "regex", before);
+	printf("%12s %12.1f\n", "table", after);
+	delete table;
+	return 0;
+}
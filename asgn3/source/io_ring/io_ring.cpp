@@ -0,0 +1,332 @@
+/** IO_Ring source file
+ *  Minimal io_uring wrapper used by the file opcodes
+ *
+ *  @author Perry David Ralston Jr.
+ *  @date 12/06/2020
+ */
+
+#include "io_ring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// the single fixed file slot the chains open files into
+static const uint32_t FILE_SLOT = 0;
+
+/**
+ * Constructor
+ * Sets up the ring, registers the buffer and an empty fixed file table and
+ * checks that the kernel can open directly into the fixed table. If any of
+ * that is unsupported the ring is torn down and ready() returns false so
+ * the callers use the plain syscalls instead.
+ **/
+IO_Ring::IO_Ring()
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	sq_ptr = cq_ptr = sqes = nullptr;
+	buf = nullptr;
+	queued = 0;
+	ring_fd = syscall(__NR_io_uring_setup, DEPTH, &params);
+	if(ring_fd == -1) {
+		return;
+	}
+	sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	if((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+	}
+	sq_ptr = mmap(0, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+	  IORING_OFF_SQ_RING);
+	if(sq_ptr == MAP_FAILED) {
+		sq_ptr = nullptr;
+		teardown();
+		return;
+	}
+	if((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		cq_ptr = sq_ptr;
+	} else {
+		cq_ptr = mmap(0, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+		  IORING_OFF_CQ_RING);
+		if(cq_ptr == MAP_FAILED) {
+			cq_ptr = nullptr;
+			teardown();
+			return;
+		}
+	}
+	sqes = (struct io_uring_sqe *)mmap(0, sqes_size, PROT_READ | PROT_WRITE,
+	  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED) {
+		sqes = nullptr;
+		teardown();
+		return;
+	}
+	sq_head = (unsigned *)((uint8_t *)sq_ptr + params.sq_off.head);
+	sq_tail = (unsigned *)((uint8_t *)sq_ptr + params.sq_off.tail);
+	sq_mask = (unsigned *)((uint8_t *)sq_ptr + params.sq_off.ring_mask);
+	sq_array = (unsigned *)((uint8_t *)sq_ptr + params.sq_off.array);
+	cq_head = (unsigned *)((uint8_t *)cq_ptr + params.cq_off.head);
+	cq_tail = (unsigned *)((uint8_t *)cq_ptr + params.cq_off.tail);
+	cq_mask = (unsigned *)((uint8_t *)cq_ptr + params.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)((uint8_t *)cq_ptr + params.cq_off.cqes);
+
+	buf = (uint8_t *)calloc(BUFFER_SIZE, sizeof(uint8_t));
+	struct iovec iov = {buf, BUFFER_SIZE};
+	int empty_slot = -1;
+	if(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) == -1
+		|| syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_FILES, &empty_slot, 1)
+			 == -1) {
+		teardown();
+		return;
+	}
+	// direct opens need 5.15, older kernels reject the file_index field
+	int32_t res[2];
+	open_slot(".", O_RDONLY | O_DIRECTORY);
+	struct io_uring_sqe *sqe = get_sqe(1);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = FILE_SLOT + 1;
+	if(submit(res, 2) == -1 || res[0] < 0 || res[1] < 0) {
+		teardown();
+	}
+}
+
+IO_Ring::~IO_Ring()
+{
+	teardown();
+}
+
+void IO_Ring::teardown()
+{
+	if(sqes != nullptr)
+		munmap(sqes, sqes_size);
+	if(cq_ptr != nullptr && cq_ptr != sq_ptr)
+		munmap(cq_ptr, cq_size);
+	if(sq_ptr != nullptr)
+		munmap(sq_ptr, sq_size);
+	if(ring_fd != -1)
+		close(ring_fd);
+	free(buf);
+	sq_ptr = cq_ptr = sqes = nullptr;
+	buf = nullptr;
+	ring_fd = -1;
+}
+
+/**
+ * get_sqe
+ * @param user_data: index of the entry in the chain, echoed in its cqe
+ * @return: zeroed submission entry, linked to the entry queued before it
+ **/
+struct io_uring_sqe *IO_Ring::get_sqe(uint64_t user_data)
+{
+	unsigned tail = *sq_tail;
+	unsigned index = tail & *sq_mask;
+	struct io_uring_sqe *sqe = &sqes[index];
+	if(queued > 0) {
+		sqes[(tail - 1) & *sq_mask].flags |= IOSQE_IO_LINK;
+	}
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = user_data;
+	sq_array[index] = index;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++queued;
+	return sqe;
+}
+
+/**
+ * submit
+ * @param res: results of the chain, indexed by user_data
+ * @param count: number of entries in the chain
+ * @return: 0 once every entry has completed, -1 otherwise. Sets errno appropriately
+ *
+ * Submits the queued chain and waits for all of it in a single
+ * io_uring_enter(2). If the kernel did not take the whole chain, the
+ * entries it left are taken back and the ones it took are still reaped
+ * before returning -1, so no late completion or write into the buffer
+ * outlives the call.
+ **/
+int8_t IO_Ring::submit(int32_t *res, unsigned count)
+{
+	unsigned to_submit = queued;
+	int saved_errno = 0;
+	queued = 0;
+	while(syscall(__NR_io_uring_enter, ring_fd, to_submit, count, IORING_ENTER_GETEVENTS, NULL, 0)
+		  == -1) {
+		if(errno != EINTR) {
+			saved_errno = errno;
+			break;
+		}
+		to_submit = 0;
+	}
+	// the ring only ever holds this chain, so whatever is left between
+	// the kernel's head and our tail was never submitted
+	unsigned tail = *sq_tail;
+	unsigned left = tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	if(left > 0) {
+		__atomic_store_n(sq_tail, tail - left, __ATOMIC_RELEASE);
+		if(saved_errno == 0)
+			saved_errno = EAGAIN;
+	}
+	unsigned in_flight = count - left;
+	unsigned head = *cq_head;
+	for(unsigned reaped = 0; reaped < in_flight; ++head, ++reaped) {
+		while(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+			// keep waiting whatever the error, the entries are in flight
+			if(syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1
+				&& errno != EINTR && saved_errno == 0)
+				saved_errno = errno;
+		}
+		struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+		if(cqe->user_data < count) {
+			res[cqe->user_data] = cqe->res;
+		}
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	if(saved_errno != 0) {
+		errno = saved_errno;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * open_slot
+ * Queues an openat of filename straight into the fixed file slot
+ **/
+void IO_Ring::open_slot(const char *filename, int flags)
+{
+	struct io_uring_sqe *sqe = get_sqe(0);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uint64_t)filename;
+	sqe->open_flags = flags;
+	sqe->file_index = FILE_SLOT + 1;
+}
+
+/**
+ * close_slot
+ * Closes the fixed file slot after a chain broke before its close ran
+ **/
+void IO_Ring::close_slot()
+{
+	int32_t res;
+	struct io_uring_sqe *sqe = get_sqe(0);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = FILE_SLOT + 1;
+	submit(&res, 1);
+}
+
+/**
+ * send_file
+ * @param filename: file to read from
+ * @param offset: offset into the file to start reading at
+ * @param size: number of bytes to read
+ * @param sock: socket to send to
+ * @param head_size: number of bytes already staged at the front of buffer()
+ * @return: number of bytes of the staged head and file data the socket
+ *          accepted, -1 if the file could not be read. Sets errno appropriately
+ *
+ * Chains openat, read into the registered buffer behind the head, send
+ * and close. A short read means the file is smaller than offset + size,
+ * which is reported as EINVAL and nothing is sent.
+ **/
+ssize_t IO_Ring::send_file(
+  const char *filename, uint64_t offset, size_t size, int sock, size_t head_size)
+{
+	int32_t res[4];
+	struct io_uring_sqe *sqe;
+	open_slot(filename, O_RDONLY);
+	sqe = get_sqe(1);
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = FILE_SLOT;
+	sqe->addr = (uint64_t)(buf + head_size);
+	sqe->len = size;
+	sqe->off = offset;
+	sqe->buf_index = 0;
+	sqe = get_sqe(2);
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = sock;
+	sqe->addr = (uint64_t)buf;
+	sqe->len = head_size + size;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe = get_sqe(3);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = FILE_SLOT + 1;
+	if(submit(res, 4) == -1) {
+		return -1;
+	}
+	if(res[0] < 0) {
+		errno = -res[0];
+		return -1;
+	}
+	if(res[1] < 0 || (size_t)res[1] < size) {
+		errno = res[1] < 0 ? -res[1] : EINVAL;
+		close_slot();
+		return -1;
+	}
+	if(res[3] < 0) {
+		close_slot();
+	}
+	// the caller finishes a short or refused send on the socket
+	return res[2] < 0 ? 0 : res[2];
+}
+
+/**
+ * write_file
+ * @param filename: file to write to
+ * @param offset: offset into the file to start writing at
+ * @param size: number of bytes staged at the front of buffer() to write
+ * @param sock: socket to send the reply to
+ * @param reply_size: number of reply bytes staged right after the data
+ * @return: number of reply bytes the socket accepted, -1 if the file
+ *          could not be written. Sets errno appropriately
+ *
+ * Chains openat, write from the registered buffer, close and the send of
+ * the reply, so the reply only goes out once the data is written.
+ **/
+ssize_t IO_Ring::write_file(
+  const char *filename, uint64_t offset, size_t size, int sock, size_t reply_size)
+{
+	int32_t res[4];
+	struct io_uring_sqe *sqe;
+	open_slot(filename, O_WRONLY);
+	sqe = get_sqe(1);
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = FILE_SLOT;
+	sqe->addr = (uint64_t)buf;
+	sqe->len = size;
+	sqe->off = offset;
+	sqe->buf_index = 0;
+	sqe = get_sqe(2);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = FILE_SLOT + 1;
+	sqe = get_sqe(3);
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = sock;
+	sqe->addr = (uint64_t)(buf + size);
+	sqe->len = reply_size;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	if(submit(res, 4) == -1) {
+		return -1;
+	}
+	if(res[0] < 0) {
+		errno = -res[0];
+		return -1;
+	}
+	if(res[1] < 0 || (size_t)res[1] < size) {
+		errno = res[1] < 0 ? -res[1] : EIO;
+		close_slot();
+		return -1;
+	}
+	return res[3] < 0 ? 0 : res[3];
+}
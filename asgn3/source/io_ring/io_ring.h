@@ -0,0 +1,63 @@
+/** IO_Ring header file
+ *  Minimal io_uring wrapper used by the file opcodes. A request's open,
+ *  file read/write, close and socket send are linked into one chain and
+ *  submitted with a single io_uring_enter(2). The ring owns one
+ *  registered buffer and one fixed file slot that the chain opens the
+ *  file into, so no file descriptor ever reaches the process.
+ *
+ *  @author Perry David Ralston Jr.
+ *  @date 12/06/2020
+ */
+
+#ifndef IO_RING
+#define IO_RING
+
+#include <inttypes.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+class IO_Ring
+{
+  private:
+	static const unsigned DEPTH = 8;
+	int ring_fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+	uint8_t *buf;
+	unsigned queued;
+	struct io_uring_sqe *get_sqe(uint64_t);
+	int8_t submit(int32_t *, unsigned);
+	void close_slot();
+	void open_slot(const char *, int);
+	void teardown();
+
+  public:
+	static const size_t BUFFER_SIZE = UINT16_MAX + 64;
+	IO_Ring();
+	~IO_Ring();
+	bool ready()
+	{
+		return ring_fd != -1;
+	}
+	uint8_t *buffer()
+	{
+		return buf;
+	}
+	ssize_t send_file(const char *, uint64_t, size_t, int, size_t);
+	ssize_t write_file(const char *, uint64_t, size_t, int, size_t);
+};
+
+#endif
@@ -0,0 +1,343 @@
+/**
+ * LF_Table source file
+ * Lock-free hash table of split-ordered lists
+ *
+ * @author Perry David Ralston Jr.
+ * @date 12/19/2020
+ */
+
+#include "lf_table.h"
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hash_policy.h"
+
+static const uintptr_t REMOVED = 1;
+
+static inline uint64_t reverse_bits(uint64_t value)
+{
+	value = ((value >> 1) & 0x5555555555555555ull) | ((value & 0x5555555555555555ull) << 1);
+	value = ((value >> 2) & 0x3333333333333333ull) | ((value & 0x3333333333333333ull) << 2);
+	value = ((value >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((value & 0x0F0F0F0F0F0F0F0Full) << 4);
+	return __builtin_bswap64(value);
+}
+
+/**
+ * record_order
+ * @return: the record's place in the list, odd so it sorts after the
+ *          sentinel of every bucket it can fall in
+ **/
+static inline uint64_t record_order(uint64_t hash)
+{
+	return reverse_bits(hash) | 1;
+}
+
+static inline uint64_t sentinel_order(size_t bucket)
+{
+	return reverse_bits(bucket);
+}
+
+LF_Table::LF_Table(size_t size)
+{
+	size_t initial = 1;
+	while(initial < size && initial < MAX_BUCKETS) {
+		initial <<= 1;
+	}
+	buckets = (std::atomic<node *> *)calloc(MAX_BUCKETS, sizeof(std::atomic<node *>));
+	node *head = (node *)calloc(1, sizeof(node));
+	if(buckets == nullptr || head == nullptr)
+		err(EXIT_FAILURE, "lock-free table");
+	buckets[0].store(head, std::memory_order_relaxed);
+	bucket_count.store(initial, std::memory_order_relaxed);
+	count.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * ~LF_Table
+ * Frees every node still in the list, removed ones included. No thread
+ * may use the table anymore.
+ **/
+LF_Table::~LF_Table()
+{
+	node *current = buckets[0].load(std::memory_order_relaxed);
+	while(current != nullptr) {
+		node *temp = current;
+		current = (node *)(current->next.load(std::memory_order_relaxed) & ~REMOVED);
+		free_node(temp);
+	}
+	free(buckets);
+}
+
+void LF_Table::free_node(void *ptr)
+{
+	node *dead = (node *)ptr;
+	free(dead->value.load(std::memory_order_relaxed));
+	free(dead);
+}
+
+/**
+ * compare
+ * @return: <0, 0 or >0 as the node sorts before, with or after the
+ *          order and zero padded key
+ **/
+static inline int compare(uint64_t node_order, const uint8_t *node_key, uint64_t order, const uint8_t *key)
+{
+	if(node_order != order)
+		return node_order < order ? -1 : 1;
+	return memcmp(node_key, key, LF_Table::KEY_SIZE);
+}
+
+/**
+ * find
+ * @param start: sentinel to search from
+ * @param prev: set to the link that points at curr
+ * @param curr: set to the first node not sorting before the key
+ * @return: true if curr holds the key
+ *
+ * Unlinks the removed nodes it passes and retires them, so the caller
+ * must be inside the epoch
+ **/
+bool LF_Table::find(node *start, uint64_t order, const uint8_t *key, std::atomic<uintptr_t> *&prev,
+  node *&curr, int64_t ident)
+{
+retry:
+	prev = &start->next;
+	curr = (node *)prev->load(std::memory_order_acquire);
+	while(curr != nullptr) {
+		uintptr_t next = curr->next.load(std::memory_order_acquire);
+		if(next & REMOVED) {
+			uintptr_t expected = (uintptr_t)curr;
+			if(!prev->compare_exchange_strong(expected, next & ~REMOVED, std::memory_order_acq_rel))
+				goto retry;
+			epoch.retire(ident, curr, free_node);
+			curr = (node *)(next & ~REMOVED);
+			continue;
+		}
+		if(compare(curr->order, curr->key, order, key) >= 0)
+			return compare(curr->order, curr->key, order, key) == 0;
+		prev = &curr->next;
+		curr = (node *)next;
+	}
+	return false;
+}
+
+/**
+ * bucket
+ * @return: the bucket's sentinel, linking it in after its parent's
+ *          sentinel on first use
+ **/
+LF_Table::node *LF_Table::bucket(size_t index, int64_t ident)
+{
+	node *sentinel = buckets[index].load(std::memory_order_acquire);
+	if(sentinel != nullptr)
+		return sentinel;
+	// the parent drops the highest bit, its sentinel sorts just before
+	size_t parent = index & ~((size_t)1 << (63 - __builtin_clzll(index)));
+	node *start = bucket(parent, ident);
+	sentinel = (node *)calloc(1, sizeof(node));
+	if(sentinel == nullptr)
+		err(EXIT_FAILURE, "lock-free table");
+	sentinel->order = sentinel_order(index);
+	std::atomic<uintptr_t> *prev;
+	node *curr;
+	while(true) {
+		if(find(start, sentinel->order, sentinel->key, prev, curr, ident)) {
+			// another thread linked it in first
+			free(sentinel);
+			sentinel = curr;
+			break;
+		}
+		sentinel->next.store((uintptr_t)curr, std::memory_order_relaxed);
+		uintptr_t expected = (uintptr_t)curr;
+		if(prev->compare_exchange_strong(expected, (uintptr_t)sentinel, std::memory_order_release))
+			break;
+	}
+	buckets[index].store(sentinel, std::memory_order_release);
+	return sentinel;
+}
+
+/**
+ * insert
+ * @param key: valid key, shorter than KEY_SIZE
+ * @param value: copied into a new value block
+ * @param ident: calling thread's identifier
+ * @return: 0
+ *
+ * Swaps the value block of a key already in the table, the old block is
+ * retired. Doubles the buckets once they average GROW_LOAD records.
+ **/
+int8_t LF_Table::insert(const uint8_t *key, const Variant &value, int64_t ident)
+{
+	uint8_t padded[KEY_SIZE] = {0};
+	size_t length = strnlen((const char *)key, KEY_SIZE - 1);
+	memcpy(padded, key, length);
+	uint64_t hash = Wy_Hash::hash(padded, length);
+	uint64_t order = record_order(hash);
+	Variant *boxed = (Variant *)malloc(sizeof(Variant));
+	if(boxed == nullptr)
+		err(EXIT_FAILURE, "lock-free table");
+	*boxed = value;
+	node *fresh = nullptr;
+	std::atomic<uintptr_t> *prev;
+	node *curr;
+	epoch.enter(ident);
+	size_t buckets_now = bucket_count.load(std::memory_order_acquire);
+	node *start = bucket(hash & (buckets_now - 1), ident);
+	while(true) {
+		if(find(start, order, padded, prev, curr, ident)) {
+			Variant *old = curr->value.exchange(boxed, std::memory_order_acq_rel);
+			epoch.retire(ident, old, free);
+			epoch.exit(ident);
+			free(fresh);
+			return 0;
+		}
+		if(fresh == nullptr) {
+			fresh = (node *)malloc(sizeof(node));
+			if(fresh == nullptr)
+				err(EXIT_FAILURE, "lock-free table");
+			fresh->order = order;
+			memcpy(fresh->key, padded, KEY_SIZE);
+			fresh->value.store(boxed, std::memory_order_relaxed);
+		}
+		fresh->next.store((uintptr_t)curr, std::memory_order_relaxed);
+		uintptr_t expected = (uintptr_t)curr;
+		if(prev->compare_exchange_strong(expected, (uintptr_t)fresh, std::memory_order_release))
+			break;
+	}
+	epoch.exit(ident);
+	int64_t records = count.fetch_add(1, std::memory_order_relaxed) + 1;
+	if(records > (int64_t)(buckets_now * GROW_LOAD) && buckets_now < MAX_BUCKETS) {
+		bucket_count.compare_exchange_strong(buckets_now, buckets_now * 2, std::memory_order_release);
+	}
+	return 0;
+}
+
+/**
+ * remove
+ * @return: 0 on success, -1 if the key is not in the table. Sets errno
+ *
+ * Marks the node removed, which is the point the key leaves the table,
+ * then tries to unlink it. A failed unlink is finished by a later find.
+ **/
+int8_t LF_Table::remove(const uint8_t *key, int64_t ident)
+{
+	uint8_t padded[KEY_SIZE] = {0};
+	size_t length = strnlen((const char *)key, KEY_SIZE - 1);
+	memcpy(padded, key, length);
+	uint64_t hash = Wy_Hash::hash(padded, length);
+	uint64_t order = record_order(hash);
+	std::atomic<uintptr_t> *prev;
+	node *curr;
+	epoch.enter(ident);
+	node *start = bucket(hash & (bucket_count.load(std::memory_order_acquire) - 1), ident);
+	while(true) {
+		if(!find(start, order, padded, prev, curr, ident)) {
+			epoch.exit(ident);
+			errno = ENOENT;
+			return -1;
+		}
+		uintptr_t next = curr->next.load(std::memory_order_acquire);
+		if(next & REMOVED)
+			continue;
+		if(curr->next.compare_exchange_strong(next, next | REMOVED, std::memory_order_acq_rel))
+			break;
+	}
+	uintptr_t expected = (uintptr_t)curr;
+	uintptr_t next = curr->next.load(std::memory_order_relaxed) & ~REMOVED;
+	if(prev->compare_exchange_strong(expected, next, std::memory_order_acq_rel)) {
+		epoch.retire(ident, curr, free_node);
+	} else {
+		find(start, order, padded, prev, curr, ident);
+	}
+	epoch.exit(ident);
+	count.fetch_sub(1, std::memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * lookup
+ * @param value: set to a copy of the key's value
+ * @return: 0 on success, -1 if the key is not in the table. Sets errno
+ *
+ * Walks past removed nodes instead of unlinking them, so it only reads
+ **/
+int8_t LF_Table::lookup(const uint8_t *key, Variant &value, int64_t ident)
+{
+	uint8_t padded[KEY_SIZE] = {0};
+	size_t length = strnlen((const char *)key, KEY_SIZE - 1);
+	memcpy(padded, key, length);
+	uint64_t hash = Wy_Hash::hash(padded, length);
+	uint64_t order = record_order(hash);
+	epoch.enter(ident);
+	node *start = bucket(hash & (bucket_count.load(std::memory_order_acquire) - 1), ident);
+	node *curr = (node *)start->next.load(std::memory_order_acquire);
+	while(curr != nullptr) {
+		uintptr_t next = curr->next.load(std::memory_order_acquire);
+		int cmp = compare(curr->order, curr->key, order, padded);
+		if(cmp > 0)
+			break;
+		if(cmp == 0 && !(next & REMOVED)) {
+			value = *curr->value.load(std::memory_order_acquire);
+			epoch.exit(ident);
+			return 0;
+		}
+		curr = (node *)(next & ~REMOVED);
+	}
+	epoch.exit(ident);
+	errno = ENOENT;
+	return -1;
+}
+
+/**
+ * clear
+ * Removes every record. Records inserted meanwhile may survive.
+ **/
+void LF_Table::clear(int64_t ident)
+{
+	uint8_t key[KEY_SIZE];
+	epoch.enter(ident);
+	node *curr = buckets[0].load(std::memory_order_acquire);
+	while(curr != nullptr) {
+		uintptr_t next = curr->next.load(std::memory_order_acquire);
+		if((curr->order & 1) && !(next & REMOVED)) {
+			memcpy(key, curr->key, KEY_SIZE);
+			remove(key, ident);
+		}
+		curr = (node *)(next & ~REMOVED);
+	}
+	epoch.exit(ident);
+}
+
+/**
+ * dump
+ * @param fd: file to write key=value lines to
+ * @return: 0 on success, -1 otherwise. Sets errno appropriately
+ *
+ * Records changed during the dump may or may not be in it
+ **/
+int8_t LF_Table::dump(int fd, int64_t ident)
+{
+	char line[2 * KEY_SIZE + 3];
+	int8_t ret_val = 0;
+	epoch.enter(ident);
+	node *curr = buckets[0].load(std::memory_order_acquire);
+	while(curr != nullptr && ret_val == 0) {
+		uintptr_t next = curr->next.load(std::memory_order_acquire);
+		if((curr->order & 1) && !(next & REMOVED)) {
+			const Variant *value = curr->value.load(std::memory_order_acquire);
+			int length = value->isNum
+			  ? snprintf(line, sizeof(line), "%s=%ld\n", curr->key, value->data.num_val)
+			  : snprintf(line, sizeof(line), "%s=%s\n", curr->key, value->data.var_val);
+			if(write(fd, line, length) == -1)
+				ret_val = -1;
+		}
+		curr = (node *)(next & ~REMOVED);
+	}
+	epoch.exit(ident);
+	return ret_val;
+}
@@ -0,0 +1,75 @@
+/**
+ * LF_Table header file
+ * Lock-free hash table of split-ordered lists (Shalev and Shavit). Every
+ * record sits in one sorted Harris-Michael list, ordered by the bit
+ * reversed hash of its key, and each bucket points at a sentinel node
+ * in that list. Doubling the buckets only adds sentinels, so the table
+ * grows without moving a record. Removed nodes and replaced values are
+ * retired through an Epoch and freed once no thread can still see them.
+ *
+ * Lookups only write shared memory to link in a bucket's sentinel the
+ * first time the bucket is used. Every call takes the caller's ident,
+ * see epoch.h.
+ *
+ * @author Perry David Ralston Jr.
+ * @date 12/19/2020
+ */
+#ifndef LF_TABLE
+#define LF_TABLE
+
+#include <atomic>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "epoch.h"
+#include "swiss_table.h"
+
+class LF_Table
+{
+  public:
+	static const size_t KEY_SIZE = Variant::NAME_SIZE;
+	// the bucket array is reserved at this size up front, its pages
+	// only materialize once a bucket is used
+	static const size_t MAX_BUCKETS = (size_t)1 << 22;
+	// average records per bucket that doubles the buckets
+	static const size_t GROW_LOAD = 2;
+	LF_Table(size_t);
+	~LF_Table();
+	int8_t insert(const uint8_t *, const Variant &, int64_t);
+	int8_t remove(const uint8_t *, int64_t);
+	int8_t lookup(const uint8_t *, Variant &, int64_t);
+	void clear(int64_t);
+	int8_t dump(int, int64_t);
+	size_t size()
+	{
+		int64_t records = count.load(std::memory_order_relaxed);
+		return records > 0 ? records : 0;
+	}
+	// buckets the records are spread over, doubles as the table grows
+	size_t num_buckets()
+	{
+		return bucket_count.load(std::memory_order_relaxed);
+	}
+
+  private:
+	struct node {
+		// next node, the low bit is set once this node is removed
+		std::atomic<uintptr_t> next;
+		uint64_t order;
+		uint8_t key[KEY_SIZE];
+		// nullptr for bucket sentinels
+		std::atomic<Variant *> value;
+	};
+	std::atomic<node *> *buckets;
+	std::atomic<size_t> bucket_count;
+	// a remove may count before the insert it follows, so it can dip
+	// below zero for a moment
+	std::atomic<int64_t> count;
+	Epoch epoch;
+	node *bucket(size_t, int64_t);
+	bool find(node *, uint64_t, const uint8_t *, std::atomic<uintptr_t> *&, node *&, int64_t);
+	static void free_node(void *);
+};
+
+#endif
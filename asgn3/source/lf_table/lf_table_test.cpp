@@ -0,0 +1,386 @@
+/**
+ * lock-free table and epoch unit tests
+ *
+ * @author Perry David Ralston Jr
+ * @date 12/20/2020
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "lf_table.h"
+
+//Constants//
+static const size_t TESTCOUNT = 10;
+static const size_t KEY_SIZE = LF_Table::KEY_SIZE;
+static const int NUM_THREADS = 8;
+static const int64_t THREAD_KEYS = 2000;
+static const int64_t SHARED_KEYS = 64;
+
+//Test Functions//
+void testNewTable(LF_Table*);
+void testInsert(LF_Table*);
+void testLookup(LF_Table*);
+void testRemove(LF_Table*);
+void testOverwrite(LF_Table*);
+void testGrowth(LF_Table*);
+void testClear(LF_Table*);
+void testDump(LF_Table*);
+void testEpochReclaim(LF_Table*);
+void testConcurrent(LF_Table*);
+
+//Data//
+uint8_t key1[] = "foo",
+		key2[] = "bar",
+		key3[] = "foobar",
+		*key;
+Variant val1,
+		val2,
+		val3,
+		result;
+std::ifstream in_gen;
+std::string outfile, line;
+int64_t released;
+
+//Supporting Functions//
+Variant num(int64_t);
+Variant var(const uint8_t*);
+void count_release(void*);
+void* worker(void*);
+
+
+int main(){
+  void (*fun_ptr[])(LF_Table*) = {
+	testNewTable,
+	testInsert,
+	testLookup,
+	testRemove,
+	testOverwrite,
+	testGrowth,
+	testClear,
+	testDump,
+	testEpochReclaim,
+	testConcurrent
+  };
+
+  for(size_t i = 0; i < TESTCOUNT; i++) {
+	//before:
+	LF_Table* T = new LF_Table(32);
+	val1 = num(42);
+	val2 = num(-42);
+	val3 = var(key1);
+	result = num(0);
+	key = (uint8_t*) calloc(KEY_SIZE, sizeof(uint8_t));
+
+	//test:
+	fun_ptr[i](T);
+
+	//clean:
+	delete(T);
+	free(key);
+  }
+  printf("All tests passed successfully\n");
+  return 0;
+}
+
+Variant num(int64_t value) {
+	Variant v;
+	memset(&v, 0, sizeof(v));
+	v.data.num_val = value;
+	v.isNum = true;
+	return v;
+}
+
+Variant var(const uint8_t* name) {
+	Variant v;
+	memset(&v, 0, sizeof(v));
+	strncpy((char*)v.data.var_val, (const char*)name, Variant::NAME_SIZE - 1);
+	v.isNum = false;
+	return v;
+}
+
+void count_release(void* ptr) {
+	free(ptr);
+	++released;
+}
+
+void testNewTable(LF_Table* T) {
+	printf("TestNewTable: ");
+	assert(T->size() == 0);
+	assert(T->num_buckets() == 32);
+	//bucket counts round up to a power of two
+	T = new LF_Table(100);
+	assert(T->num_buckets() == 128);
+	delete(T);
+	T = new LF_Table(0);
+	assert(T->num_buckets() == 1);
+	delete(T);
+	printf("Passed\n");
+}
+
+void testInsert(LF_Table* T) {
+	printf("TestInsert: ");
+	assert(T->insert(key1, val1, 0) == 0);
+	assert(T->insert(key2, val2, 0) == 0);
+	assert(T->insert(key3, val3, 0) == 0);
+	assert(T->size() == 3);
+	printf("Passed\n");
+}
+
+void testLookup(LF_Table* T) {
+	printf("TestLookup: ");
+	T->insert(key1, val1, 0);
+	T->insert(key3, val3, 0);
+	assert(T->lookup(key1, result, 0) == 0);
+	assert(result.isNum && result.data.num_val == val1.data.num_val);
+	assert(T->lookup(key3, result, 0) == 0);
+	assert(!result.isNum && strcmp((char*)result.data.var_val, (char*)key1) == 0);
+	assert(T->lookup(key2, result, 0) == -1);
+	assert(errno == ENOENT);
+	printf("Passed\n");
+}
+
+void testRemove(LF_Table* T) {
+	printf("TestRemove: ");
+	T->insert(key1, val1, 0);
+	T->insert(key2, val2, 0);
+	assert(T->remove(key1, 0) == 0);
+	assert(T->lookup(key1, result, 0) == -1);
+	assert(T->remove(key1, 0) == -1);
+	assert(errno == ENOENT);
+	assert(T->remove(key3, 0) == -1);
+	assert(T->lookup(key2, result, 0) == 0);
+	assert(result.data.num_val == val2.data.num_val);
+	assert(T->size() == 1);
+	//a removed key can come back
+	assert(T->insert(key1, val2, 0) == 0);
+	assert(T->lookup(key1, result, 0) == 0);
+	assert(result.data.num_val == val2.data.num_val);
+	printf("Passed\n");
+}
+
+void testOverwrite(LF_Table* T) {
+	printf("TestOverwrite: ");
+	T->insert(key1, val1, 0);
+	assert(T->insert(key1, val3, 0) == 0);
+	assert(T->size() == 1);
+	assert(T->lookup(key1, result, 0) == 0);
+	assert(!result.isNum);
+	//enough replaced values to move the epoch on and free the old ones
+	for (int64_t i = 0; i < 20 * (int64_t)Epoch::ADVANCE_EVERY; ++i) {
+		assert(T->insert(key1, num(i), 0) == 0);
+		assert(T->lookup(key1, result, 0) == 0);
+		assert(result.isNum && result.data.num_val == i);
+	}
+	assert(T->size() == 1);
+	printf("Passed\n");
+}
+
+void testGrowth(LF_Table* T) {
+	printf("TestGrowth: ");
+	const int64_t count = 5000;
+	T = new LF_Table(1);
+	for (int64_t i = 0; i < count; ++i) {
+		snprintf((char*)key, KEY_SIZE, "k%ld", i);
+		assert(T->insert(key, num(i), 0) == 0);
+		assert(T->size() <= T->num_buckets() * LF_Table::GROW_LOAD);
+	}
+	//several doublings, each splitting buckets that already hold records
+	assert(T->num_buckets() >= (size_t)count / LF_Table::GROW_LOAD);
+	for (int64_t i = 0; i < count; i += 2) {
+		snprintf((char*)key, KEY_SIZE, "k%ld", i);
+		assert(T->remove(key, 0) == 0);
+	}
+	for (int64_t i = 0; i < count; ++i) {
+		snprintf((char*)key, KEY_SIZE, "k%ld", i);
+		if (i % 2 == 0) {
+			assert(T->lookup(key, result, 0) == -1);
+		} else {
+			assert(T->lookup(key, result, 0) == 0);
+			assert(result.data.num_val == i);
+		}
+	}
+	assert(T->size() == count / 2);
+	delete(T);
+	printf("Passed\n");
+}
+
+void testClear(LF_Table* T) {
+	printf("TestClear: ");
+	for (int64_t i = 0; i < 500; ++i) {
+		snprintf((char*)key, KEY_SIZE, "k%ld", i);
+		T->insert(key, num(i), 0);
+	}
+	T->clear(0);
+	assert(T->size() == 0);
+	for (int64_t i = 0; i < 500; ++i) {
+		snprintf((char*)key, KEY_SIZE, "k%ld", i);
+		assert(T->lookup(key, result, 0) == -1);
+	}
+	assert(T->insert(key1, val1, 0) == 0);
+	assert(T->lookup(key1, result, 0) == 0);
+	assert(T->size() == 1);
+	printf("Passed\n");
+}
+
+void testDump(LF_Table* T) {
+	printf("TestDump: ");
+	char name[KEY_SIZE], value[KEY_SIZE];
+	T->insert(key1, val1, 0);
+	T->insert(key2, val2, 0);
+	T->insert(key3, val3, 0);
+	T->insert(key2, num(7), 0);
+	T->remove(key1, 0);
+	outfile = "outfile.txt";
+	int fd = open(outfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fd != -1);
+	assert(T->dump(fd, 0) == 0);
+	close(fd);
+
+	in_gen.open(outfile);
+	assert(in_gen.good());
+	int64_t lines = 0;
+	while (getline(in_gen, line)) {
+		assert(sscanf(line.c_str(), "%[^=]=%s", name, value) == 2);
+		if (strcmp(name, (char*)key2) == 0) {
+			assert(strcmp(value, "7") == 0);
+		} else {
+			assert(strcmp(name, (char*)key3) == 0);
+			assert(strcmp(value, (char*)key1) == 0);
+		}
+		++lines;
+	}
+	in_gen.close();
+	assert(lines == 2);
+	if (remove(outfile.c_str()) == -1) {
+		warn("Unable to delete %s: %s", outfile.c_str(), strerror(errno));
+	}
+	printf("Passed\n");
+}
+
+void testEpochReclaim(LF_Table*) {
+	printf("TestEpochReclaim: ");
+	const int64_t rounds = 8 * Epoch::ADVANCE_EVERY;
+	Epoch* E = new Epoch();
+	released = 0;
+	//a thread left inside the domain holds every retirement back
+	E->enter(1);
+	for (int64_t i = 0; i < rounds; ++i) {
+		E->enter(0);
+		E->retire(0, malloc(8), count_release);
+		E->exit(0);
+	}
+	assert(released == 0);
+	E->exit(1);
+	for (int64_t i = 0; i < rounds; ++i) {
+		E->enter(0);
+		E->retire(0, malloc(8), count_release);
+		E->exit(0);
+	}
+	assert(released > 0);
+	assert(released < 2 * rounds);
+	//the rest goes with the domain
+	delete(E);
+	assert(released == 2 * rounds);
+	printf("Passed\n");
+}
+
+struct worker_args {
+	LF_Table* table;
+	int64_t ident;
+};
+
+/**
+ * worker
+ * Inserts its own keys, removes every odd one and checks the rest, while
+ * churning the keys every worker shares
+ **/
+void* worker(void* arg) {
+	worker_args* self = (worker_args*) arg;
+	uint8_t name[KEY_SIZE];
+	Variant found;
+	uint32_t seed = self->ident + 1;
+	for (int64_t i = 0; i < THREAD_KEYS; ++i) {
+		snprintf((char*)name, KEY_SIZE, "t%ld_%ld", self->ident, i);
+		assert(self->table->insert(name, num(i), self->ident) == 0);
+		seed = seed * 1103515245 + 12345;
+		snprintf((char*)name, KEY_SIZE, "s%ld", (int64_t)((seed >> 8) % SHARED_KEYS));
+		if ((seed >> 4) % 3 == 0) {
+			self->table->remove(name, self->ident);
+		} else if ((seed >> 4) % 3 == 1) {
+			self->table->insert(name, num(self->ident), self->ident);
+		} else if (self->table->lookup(name, found, self->ident) == 0) {
+			assert(found.isNum && found.data.num_val >= 0 && found.data.num_val < NUM_THREADS);
+		}
+	}
+	for (int64_t i = 1; i < THREAD_KEYS; i += 2) {
+		snprintf((char*)name, KEY_SIZE, "t%ld_%ld", self->ident, i);
+		assert(self->table->remove(name, self->ident) == 0);
+	}
+	for (int64_t i = 0; i < THREAD_KEYS; ++i) {
+		snprintf((char*)name, KEY_SIZE, "t%ld_%ld", self->ident, i);
+		if (i % 2 == 0) {
+			assert(self->table->lookup(name, found, self->ident) == 0);
+			assert(found.data.num_val == i);
+		} else {
+			assert(self->table->lookup(name, found, self->ident) == -1);
+		}
+	}
+	return NULL;
+}
+
+void testConcurrent(LF_Table* T) {
+	printf("TestConcurrent: ");
+	pthread_t tids[NUM_THREADS];
+	worker_args args[NUM_THREADS];
+	T = new LF_Table(1);
+	for (int i = 0; i < NUM_THREADS; ++i) {
+		args[i] = {T, i};
+		assert(pthread_create(&tids[i], NULL, worker, &args[i]) == 0);
+	}
+	for (int i = 0; i < NUM_THREADS; ++i) {
+		pthread_join(tids[i], NULL);
+	}
+	//every worker's even keys survive, and the shared keys hold a writer's ident
+	int64_t shared = 0;
+	for (int64_t i = 0; i < SHARED_KEYS; ++i) {
+		snprintf((char*)key, KEY_SIZE, "s%ld", i);
+		if (T->lookup(key, result, 0) == 0) {
+			assert(result.isNum && result.data.num_val >= 0 && result.data.num_val < NUM_THREADS);
+			++shared;
+		}
+	}
+	for (int t = 0; t < NUM_THREADS; ++t) {
+		for (int64_t i = 0; i < THREAD_KEYS; ++i) {
+			snprintf((char*)key, KEY_SIZE, "t%d_%ld", t, i);
+			assert((T->lookup(key, result, 0) == 0) == (i % 2 == 0));
+		}
+	}
+	assert(T->size() == (size_t)(NUM_THREADS * THREAD_KEYS / 2 + shared));
+	//the dump walks the same list the lookups found
+	outfile = "outfile.txt";
+	int fd = open(outfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fd != -1);
+	assert(T->dump(fd, 0) == 0);
+	close(fd);
+	in_gen.open(outfile);
+	int64_t lines = 0;
+	while (getline(in_gen, line)) {
+		++lines;
+	}
+	in_gen.close();
+	assert(lines == (int64_t)T->size());
+	if (remove(outfile.c_str()) == -1) {
+		warn("Unable to delete %s: %s", outfile.c_str(), strerror(errno));
+	}
+	delete(T);
+	printf("Passed\n");
+}
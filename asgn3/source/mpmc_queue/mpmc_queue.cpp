@@ -0,0 +1,38 @@
+/** MPMC_Queue source file
+ *  Futex helpers used to park and wake the queue's consumers
+ *
+ *  @author Perry David Ralston Jr.
+ *  @date 12/02/2020
+ */
+
+#include "mpmc_queue.h"
+#include <atomic>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * futex_wait
+ * @param word: futex word to sleep on
+ * @param expected: value the word must still hold for the caller to sleep
+ * @param timeout: relative timeout, NULL to sleep until woken
+ * @return: 0 when woken, -1 otherwise. Sets errno appropriately
+ **/
+int futex_wait(std::atomic<uint32_t> *word, uint32_t expected, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+/**
+ * futex_wake
+ * @param word: futex word to wake sleepers on
+ * @param count: maximum number of sleepers to wake
+ * @return: number of threads woken
+ **/
+int futex_wake(std::atomic<uint32_t> *word, int count)
+{
+	return syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
@@ -0,0 +1,224 @@
+/** MPMC_Queue header file
+ *  Bounded lock-free multi-producer/multi-consumer queue used to hand
+ *  work from the event loop to the worker threads. Consumers that find
+ *  the queue empty park on a futex instead of spinning.
+ *
+ *  The ring follows Dmitry Vyukov's bounded MPMC queue: every cell
+ *  carries a sequence number that tells producers and consumers whether
+ *  the cell is free for the current lap.
+ *
+ *  @author Perry David Ralston Jr.
+ *  @date 12/02/2020
+ */
+
+#ifndef MPMC_QUEUE
+#define MPMC_QUEUE
+
+#include <atomic>
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <time.h>
+
+static const size_t CACHE_LINE = 64;
+
+int futex_wait(std::atomic<uint32_t> *, uint32_t, const struct timespec * = NULL);
+int futex_wake(std::atomic<uint32_t> *, int);
+
+template<class T>
+class MPMC_Queue
+{
+  private:
+	struct cell {
+		std::atomic<size_t> seq;
+		T data;
+	};
+	cell *cells;
+	size_t mask;
+	alignas(CACHE_LINE) std::atomic<size_t> enq_pos;
+	alignas(CACHE_LINE) std::atomic<size_t> deq_pos;
+	// bumped by producers so parked consumers notice new work
+	alignas(CACHE_LINE) std::atomic<uint32_t> generation;
+	std::atomic<uint32_t> sleepers;
+
+  public:
+	static const size_t DEFAULT_SIZE = 1024;
+	MPMC_Queue() : MPMC_Queue(DEFAULT_SIZE){};
+	MPMC_Queue(size_t);
+	~MPMC_Queue();
+	bool push(T);
+	void push_wait(T);
+	bool pop(T &);
+	T pop_wait();
+	bool pop_wait(T &, const struct timespec *);
+	size_t size()
+	{
+		size_t enq = enq_pos.load(std::memory_order_relaxed);
+		size_t deq = deq_pos.load(std::memory_order_relaxed);
+		return enq > deq ? enq - deq : 0;
+	}
+	size_t capacity()
+	{
+		return mask + 1;
+	}
+	bool has_sleepers()
+	{
+		return sleepers.load(std::memory_order_relaxed) > 0;
+	}
+};
+
+/**
+ * Constructor
+ * @param size: requested capacity, rounded up to a power of two
+ **/
+template<class T>
+MPMC_Queue<T>::MPMC_Queue(size_t size)
+{
+	size_t cap = 2;
+	while(cap < size) {
+		cap <<= 1;
+	}
+	mask = cap - 1;
+	cells = (cell *)calloc(cap, sizeof(cell));
+	for(size_t i = 0; i < cap; ++i) {
+		cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+	enq_pos.store(0, std::memory_order_relaxed);
+	deq_pos.store(0, std::memory_order_relaxed);
+	generation.store(0, std::memory_order_relaxed);
+	sleepers.store(0, std::memory_order_relaxed);
+}
+
+template<class T>
+MPMC_Queue<T>::~MPMC_Queue()
+{
+	free(cells);
+	cells = nullptr;
+}
+
+/**
+ * push
+ * @param data: item to enqueue
+ * @return: false if the queue is full
+ *
+ * Claims the next cell with a CAS on enq_pos and publishes the item by
+ * advancing the cell's sequence. Wakes one parked consumer if any.
+ **/
+template<class T>
+bool MPMC_Queue<T>::push(T data)
+{
+	cell *curr;
+	size_t pos = enq_pos.load(std::memory_order_relaxed);
+	while(true) {
+		curr = &cells[pos & mask];
+		size_t seq = curr->seq.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if(diff == 0) {
+			if(enq_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if(diff < 0) {
+			return false;
+		} else {
+			pos = enq_pos.load(std::memory_order_relaxed);
+		}
+	}
+	curr->data = data;
+	curr->seq.store(pos + 1, std::memory_order_release);
+	// pairs with the fence in pop_wait so a consumer is never left parked
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(sleepers.load(std::memory_order_relaxed) > 0) {
+		generation.fetch_add(1, std::memory_order_release);
+		futex_wake(&generation, 1);
+	}
+	return true;
+}
+
+/**
+ * push_wait
+ * @param data: item to enqueue
+ *
+ * Pushes the item, yielding while the queue is full.
+ **/
+template<class T>
+void MPMC_Queue<T>::push_wait(T data)
+{
+	while(!push(data)) {
+		sched_yield();
+	}
+}
+
+/**
+ * pop
+ * @param data: reference to store the dequeued item in
+ * @return: false if the queue is empty
+ **/
+template<class T>
+bool MPMC_Queue<T>::pop(T &data)
+{
+	cell *curr;
+	size_t pos = deq_pos.load(std::memory_order_relaxed);
+	while(true) {
+		curr = &cells[pos & mask];
+		size_t seq = curr->seq.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+		if(diff == 0) {
+			if(deq_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if(diff < 0) {
+			return false;
+		} else {
+			pos = deq_pos.load(std::memory_order_relaxed);
+		}
+	}
+	data = curr->data;
+	curr->seq.store(pos + mask + 1, std::memory_order_release);
+	return true;
+}
+
+/**
+ * pop_wait
+ * @return: the dequeued item
+ *
+ * Pops an item, parking the calling thread until one arrives.
+ **/
+template<class T>
+T MPMC_Queue<T>::pop_wait()
+{
+	T data;
+	pop_wait(data, NULL);
+	return data;
+}
+
+/**
+ * pop_wait
+ * @param data: reference to store the dequeued item in
+ * @param timeout: longest time to stay parked, NULL to wait forever
+ * @return: false if the queue stayed empty for the whole timeout
+ *
+ * Pops an item, parking the calling thread on the generation futex while
+ * the queue is empty. The generation is read before registering as a
+ * sleeper so a push that lands in between makes futex_wait return at once.
+ **/
+template<class T>
+bool MPMC_Queue<T>::pop_wait(T &data, const struct timespec *timeout)
+{
+	while(!pop(data)) {
+		uint32_t gen = generation.load(std::memory_order_acquire);
+		sleepers.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(pop(data)) {
+			sleepers.fetch_sub(1, std::memory_order_relaxed);
+			break;
+		}
+		int res = futex_wait(&generation, gen, timeout);
+		sleepers.fetch_sub(1, std::memory_order_relaxed);
+		if(res == -1 && errno == ETIMEDOUT) {
+			return pop(data);
+		}
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * MPMC_Queue hand-off benchmark
+ *
+ * Measures how many connections per second the dispatch thread can hand
+ * to N workers. Compares the old slot scan + semaphore hand-off against
+ * MPMC_Queue with futex parking.
+ *
+ * usage: ./mpmc_queue_bench [max_workers] [handoffs]
+ *
+ * @author Perry David Ralston Jr
+ * @date 12/02/2020
+ */
+
+#include <atomic>
+#include <err.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "mpmc_queue.h"
+
+static const int STOP = -1;
+
+struct slot {
+	sem_t mutex;
+	sem_t *mainMutex;
+	volatile int cl;
+	int64_t handled;
+};
+
+struct consumer {
+	MPMC_Queue<int> *queue;
+	int64_t handled;
+};
+
+/*----------slot scan + semaphores (previous dispatch) --------------*/
+
+void *slot_worker(void *arg)
+{
+	slot *self = (slot *)arg;
+	while(true) {
+		while(self->cl == 0) {
+			if(0 != sem_wait(&self->mutex))
+				err(2, "sem_wait in worker");
+		}
+		if(self->cl == STOP)
+			return NULL;
+		++self->handled;
+		self->cl = 0;
+		if(0 != sem_post(self->mainMutex))
+			err(2, "sem_post of main in worker");
+	}
+}
+
+int getWorker(slot *slots, int num_threads)
+{
+	for(int i = 0; i < num_threads; ++i) {
+		if(slots[i].cl == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+double bench_slots(int num_threads, int64_t handoffs)
+{
+	sem_t mainMutex;
+	slot *slots = (slot *)calloc(num_threads, sizeof(slot));
+	pthread_t *tids = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+	sem_init(&mainMutex, 0, 0);
+	for(int i = 0; i < num_threads; ++i) {
+		sem_init(&slots[i].mutex, 0, 0);
+		slots[i].mainMutex = &mainMutex;
+		pthread_create(&tids[i], NULL, slot_worker, &slots[i]);
+	}
+	double begin = now();
+	int worker;
+	for(int64_t i = 0; i < handoffs; ++i) {
+		while((worker = getWorker(slots, num_threads)) == -1) {
+			sem_wait(&mainMutex);
+		}
+		slots[worker].cl = 1;
+		sem_post(&slots[worker].mutex);
+	}
+	for(int i = 0; i < num_threads; ++i) {
+		while((worker = getWorker(slots, num_threads)) == -1) {
+			sem_wait(&mainMutex);
+		}
+		slots[worker].cl = STOP;
+		sem_post(&slots[worker].mutex);
+	}
+	for(int i = 0; i < num_threads; ++i) {
+		pthread_join(tids[i], NULL);
+	}
+	double elapsed = now() - begin;
+	free(slots);
+	free(tids);
+	return handoffs / elapsed;
+}
+
+/*----------MPMC_Queue + futex parking --------------*/
+
+void *queue_worker(void *arg)
+{
+	consumer *self = (consumer *)arg;
+	while(self->queue->pop_wait() != STOP) {
+		++self->handled;
+	}
+	return NULL;
+}
+
+double bench_queue(int num_threads, int64_t handoffs)
+{
+	MPMC_Queue<int> queue;
+	consumer *consumers = (consumer *)calloc(num_threads, sizeof(consumer));
+	pthread_t *tids = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+	for(int i = 0; i < num_threads; ++i) {
+		consumers[i].queue = &queue;
+		pthread_create(&tids[i], NULL, queue_worker, &consumers[i]);
+	}
+	double begin = now();
+	for(int64_t i = 0; i < handoffs; ++i) {
+		queue.push_wait(1);
+	}
+	for(int i = 0; i < num_threads; ++i) {
+		queue.push_wait(STOP);
+	}
+	for(int i = 0; i < num_threads; ++i) {
+		pthread_join(tids[i], NULL);
+	}
+	double elapsed = now() - begin;
+	free(consumers);
+	free(tids);
+	return handoffs / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	int max_threads = argc > 1 ? atoi(argv[1]) : 16;
+	int64_t handoffs = argc > 2 ? atol(argv[2]) : 200000;
+	printf("%8s %18s %18s\n", "-N", "slots (conn/s)", "mpmc (conn/s)");
+	for(int n = 1; n <= max_threads; n *= 2) {
+		double slots = bench_slots(n, handoffs);
+		double queue = bench_queue(n, handoffs);
+		printf("%8d %18.0f %18.0f\n", n, slots, queue);
+	}
+	return 0;
+}
@@ -0,0 +1,128 @@
+/** Placement source file
+ *  Helpers to pin threads to cores and to place memory on NUMA nodes
+ *
+ *  @author Perry David Ralston Jr.
+ *  @date 12/11/2020
+ */
+
+#include "placement.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// nodes past this are ignored, the node mask is a single word
+static const int MAX_NODES = 64;
+
+/**
+ * pin_thread
+ * @param index: worker index, wraps around the cpus the process may use
+ * @return: cpu the calling thread is now pinned to, -1 on error. Sets errno appropriately
+ **/
+int pin_thread(int index)
+{
+	cpu_set_t allowed, target;
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+		return -1;
+	int count = CPU_COUNT(&allowed);
+	if(count == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	int skip = index % count, cpu = 0;
+	for(; cpu < CPU_SETSIZE; ++cpu) {
+		if(CPU_ISSET(cpu, &allowed) && skip-- == 0)
+			break;
+	}
+	CPU_ZERO(&target);
+	CPU_SET(cpu, &target);
+	int res = pthread_setaffinity_np(pthread_self(), sizeof(target), &target);
+	if(res != 0) {
+		errno = res;
+		return -1;
+	}
+	return cpu;
+}
+
+/**
+ * current_node
+ * @return: NUMA node of the cpu the calling thread runs on
+ **/
+int current_node()
+{
+	unsigned cpu, node;
+	if(syscall(SYS_getcpu, &cpu, &node, NULL) == -1)
+		return 0;
+	return node;
+}
+
+/**
+ * node_count
+ * @return: number of NUMA nodes with memory, at least 1
+ **/
+int node_count()
+{
+	char path[64];
+	int count = 0;
+	while(count < MAX_NODES) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", count);
+		if(access(path, F_OK) == -1)
+			break;
+		++count;
+	}
+	return count > 0 ? count : 1;
+}
+
+/**
+ * mbind_pages
+ * Applies a memory policy to every page that overlaps [addr, addr + len).
+ * The range is widened to page boundaries, which only changes where the
+ * neighbouring bytes are placed.
+ **/
+static int8_t mbind_pages(void *addr, size_t len, int mode, unsigned long mask)
+{
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t first = (uintptr_t)addr & ~(page - 1);
+	uintptr_t last = ((uintptr_t)addr + len + page - 1) & ~(page - 1);
+	if(syscall(SYS_mbind, first, last - first, mode, &mask, MAX_NODES, MPOL_MF_MOVE) == -1)
+		return -1;
+	return 0;
+}
+
+/**
+ * interleave
+ * @param addr: start of memory shared by every worker
+ * @param len: length of the memory
+ * @return: 0 on success, -1 otherwise. Sets errno appropriately
+ *
+ * Spreads the pages round-robin over every node so no single node
+ * serves all of the traffic.
+ **/
+int8_t interleave(void *addr, size_t len)
+{
+	int nodes = node_count();
+	if(nodes == 1)
+		return 0;
+	unsigned long mask = nodes == MAX_NODES ? ~0ul : (1ul << nodes) - 1;
+	return mbind_pages(addr, len, MPOL_INTERLEAVE, mask);
+}
+
+/**
+ * bind_local
+ * @param addr: start of memory used by the calling thread
+ * @param len: length of the memory
+ * @return: 0 on success, -1 otherwise. Sets errno appropriately
+ *
+ * Moves the pages to the node the calling thread runs on. Only useful
+ * once the thread is pinned.
+ **/
+int8_t bind_local(void *addr, size_t len)
+{
+	if(node_count() == 1)
+		return 0;
+	return mbind_pages(addr, len, MPOL_PREFERRED, 1ul << current_node());
+}
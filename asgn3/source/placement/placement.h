@@ -0,0 +1,25 @@
+/** Placement header file
+ *  Helpers to pin threads to cores and to place memory on NUMA nodes.
+ *  Memory policies are applied with mbind(2) straight through the
+ *  syscall, so libnuma is not needed. Every helper is a hint: on a
+ *  single node machine or a kernel without NUMA support they fail
+ *  quietly and the default first-touch placement is kept.
+ *
+ *  @author Perry David Ralston Jr.
+ *  @date 12/11/2020
+ */
+
+#ifndef PLACEMENT
+#define PLACEMENT
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+int pin_thread(int);
+int current_node();
+int node_count();
+int8_t interleave(void *, size_t);
+int8_t bind_local(void *, size_t);
+
+#endif
@@ -27,8 +27,143 @@
 #include "process_funcs.h"
 #include "structs.h"
 
-void process(Thread* self){
-	Bounded_Buffer buffer;
+/**
+ * frame_name
+ * @return: 1 if a valid variable name fits in avail, 0 if the name is
+ *          invalid and process() stops reading there, -1 if more bytes
+ *          are needed
+ **/
+int8_t frame_name(const uint8_t *bytes, size_t avail, size_t &pos)
+{
+	if(pos >= avail)
+		return -1;
+	int8_t size = (int8_t)bytes[pos++];
+	if(size <= 0 || (size_t)size >= SyncHash::DEFAULT_SIZE)
+		return 0;
+	pos += size;
+	return pos <= avail ? 1 : -1;
+}
+
+/**
+ * request_size
+ * @param bytes: buffered bytes of the client, starting at a request
+ * @param avail: number of buffered bytes
+ * @return: number of bytes process() reads for the request, 0 if more
+ *          bytes are needed to tell
+ *
+ * Mirrors the parsing in process() without acting on the request. The
+ * payload of a write is not counted, it is streamed into the file. A
+ * batch counts every sub-request, including the payloads of its writes
+ * and any batch nested in it, so a nested batch can be skipped whole.
+ **/
+size_t request_size(const uint8_t *bytes, size_t avail)
+{
+	size_t pos = sizeof(uint16_t) + sizeof(uint32_t);
+	int8_t valid = 1;
+	if(avail < pos)
+		return 0;
+	uint16_t op = (bytes[0] << 8) | bytes[1];
+	int16_t math_op = (op & MATH_OPS) + (op & FINAL_BYTE);
+	ssize_t fun_index = (math_op & FINAL_BYTE) - 1;
+	if(op == CLEAR_OP) {
+		pos += sizeof(uint32_t);
+	} else if(op == BATCH_OP) {
+		if(avail < pos + sizeof(uint16_t))
+			return 0;
+		uint16_t count = (bytes[pos] << 8) | bytes[pos + 1];
+		pos += sizeof(uint16_t);
+		for(uint16_t i = 0; i < count; ++i) {
+			size_t sub = request_size(bytes + pos, avail - pos);
+			if(sub == 0)
+				return 0;
+			if(((bytes[pos] << 8) | bytes[pos + 1]) == 0x0202)
+				sub += (bytes[pos + sub - 2] << 8) | bytes[pos + sub - 1];
+			pos += sub;
+			if(pos > avail)
+				return 0;
+		}
+	} else if((op & MATH_OPS) != 0 && fun_index < MATH_FUNC_COUNT) {
+		for(size_t i = 0; i < ARG_COUNT && fun_index != -1 && valid == 1; ++i) {
+			if((op & FLAGS[i]) != 0) {
+				valid = frame_name(bytes, avail, pos);
+			} else if(i != ARG_COUNT - 1) {
+				pos += sizeof(int64_t);
+			}
+		}
+	} else if((op & MATH_OPS) != 0) {
+		valid = frame_name(bytes, avail, pos);
+		if(valid == 1 && math_op == 0x0109) {
+			valid = frame_name(bytes, avail, pos);
+		}
+	} else if(op == 0x0201 || op == 0x0202 || op == 0x0210 || op == 0x0220) {
+		if(avail < pos + sizeof(uint16_t))
+			return 0;
+		pos += sizeof(uint16_t) + ((bytes[pos] << 8) | bytes[pos + 1]);
+		if(op == 0x0201 || op == 0x0202)
+			pos += sizeof(uint64_t) + sizeof(uint16_t);
+	}
+	if(valid == -1 || pos > avail)
+		return 0;
+	return pos;
+}
+
+/**
+ * shed_request
+ * @param buffer: connection with a whole request at the front
+ * @return: false if the request is not all buffered yet, or there is
+ *          no room for its reply until the client reads
+ *
+ * Answers the request with an EBUSY header instead of running it. A
+ * write is only shed once its payload has arrived too, and a full reply
+ * buffer is only sent as far as the socket takes it, so shedding never
+ * waits on the client.
+ **/
+bool shed_request(Bounded_Buffer& buffer) {
+	const uint8_t* bytes = buffer.peek();
+	size_t size = request_size(bytes, buffer.buffered());
+	if (size == 0) {
+		return false;
+	}
+	if (((bytes[0] << 8) | bytes[1]) == 0x0202) {
+		size += (bytes[size - 2] << 8) | bytes[size - 1];
+	}
+	if (size > buffer.buffered()) {
+		return false;
+	}
+	if (buffer.out_space() < HEADER_SIZE && buffer.flush_now() == -1) {
+		return false;
+	}
+	resp_header header;
+	build_header(header, buffer);
+	header.err_code = EBUSY;
+	send_header(header, buffer);
+	buffer.dump(size - sizeof(uint16_t) - sizeof(uint32_t));
+	return true;
+}
+
+/**
+ * process
+ * @param self: worker running the request
+ *
+ * @param in_batch: the request is part of a batch, nested batches are
+ *        answered with ENOTSUP and skipped
+ *
+ * Reads and answers a single request from self->conn. The scheduler
+ * decides where the connection goes afterwards, so a client with more
+ * requests waiting does not hold on to this worker.
+ *
+ * A batch (BATCH_OP) carries a count and that many requests. It is
+ * answered with its own header, the count and then the responses of
+ * the requests, in order. A batch must fit in the connection's buffer,
+ * write payloads included, or it could hold the worker on a slow
+ * client. A larger one is answered with EMSGSIZE and, since the rest of
+ * it cannot be told apart from the next request, the connection closed.
+ *
+ * SHM_OP moves a unix domain socket client onto a shared memory channel,
+ * the reply header carries the channel's descriptors.
+ **/
+void process(Thread* self, bool in_batch = false){
+	Bounded_Buffer& buffer = self->conn->buffer;
 	resp_header header;
 	uint64_t offset; 
 	int64_t file_size;
@@ -36,216 +171,253 @@ void process(Thread* self){
 	int16_t math_op;
 	uint16_t filename_size = 0, buff_size = 0;
 	uint8_t *filename, *keyname, *var_result, var_name_size;
-	uint8_t** var_args = (uint8_t**)calloc(ARG_COUNT, sizeof(char*));
-	buffer.client_fd = self->cl;
+	uint8_t**& var_args = self->var_args;
 	ssize_t fun_index;
+	IO_Ring* ring;
+	const uint8_t* bytes = buffer.peek();
+	//request_ready() only hands over a partial request when it filled the buffer
+	bool oversized = !in_batch && buffer.buffered() >= sizeof(uint16_t)
+	  && ((bytes[0] << 8) | bytes[1]) == BATCH_OP && request_size(bytes, buffer.buffered()) == 0;
+	//the enclosing batch was framed whole, so a nested one is all buffered
+	size_t nested = in_batch && buffer.buffered() >= sizeof(uint16_t)
+	  && ((bytes[0] << 8) | bytes[1]) == BATCH_OP ? request_size(bytes, buffer.buffered()) : 0;
 
-	while(buffer.client_fd != 0) {
-		build_header(header, buffer);
-		if(header.op == CLEAR_OP) {
-			uint32_t confirm;
-			if(conv_frm_nbo(buffer, confirm) == -1 || confirm != CLEAR_CONFIRM) {
-				errno = EINVAL;
-				send_err_header(header, buffer);
-			}
-			self->hTable->clear(self->ident);
-			send_header(header, buffer);
-		} else if ((header.op & MATH_OPS) != 0) {
-			math_op = (header.op & MATH_OPS) + (header.op & FINAL_BYTE);
-			fun_index = (math_op & FINAL_BYTE) - 1;
-			if (fun_index < MATH_FUNC_COUNT) {
-				for (size_t i = 0; i < ARG_COUNT && fun_index != -1; ++i) {
-					if ((header.op & FLAGS[i]) != 0) {
-						var_args[i] = (uint8_t*)calloc(SyncHash::DEFAULT_SIZE, sizeof(uint8_t));
-						if (getVarName(buffer, var_args[i]) == -1) {
-							handle_math_arg_error(header, buffer, self, var_args, fun_index);
-						}
-					} else if (i != ARG_COUNT - 1) {
-						if (conv_frm_nbo<int64_t>(buffer, arith_args[i]) == -1) {
-							handle_math_arg_error(header, buffer, self, var_args, fun_index);
-						}
-					}
-				}
-				if (var_args[2] != nullptr && fun_index != -1) {
-					//if the result is one of the args then operation must be atomic
-					if(self->hTable->acquire(var_args, ARG_COUNT, self->ident) == -1) {
+	build_header(header, buffer);
+	if(buffer.client_fd == 0) {
+		return;
+	}
+	if(header.op == CLEAR_OP) {
+		uint32_t confirm;
+		if(conv_frm_nbo(buffer, confirm) == -1 || confirm != CLEAR_CONFIRM) {
+			errno = EINVAL;
+			send_err_header(header, buffer);
+		}
+		self->hTable->clear(self->ident);
+		send_header(header, buffer);
+	} else if (header.op == BATCH_OP && !in_batch) {
+		uint16_t count;
+		if (oversized) {
+			errno = EMSGSIZE;
+			send_err_header(header, buffer);
+			buffer.flush();
+			buffer.close_cl();
+			return;
+		}
+		if (conv_frm_nbo(buffer, count) == -1) {
+			return;
+		}
+		send_header(header, buffer);
+		conv_to_nbo<uint16_t>(buffer, count);
+		for (uint16_t i = 0; i < count && buffer.client_fd != 0; ++i) {
+			process(self, true);
+		}
+	} else if (header.op == BATCH_OP) {
+		header.err_code = ENOTSUP;
+		send_header(header, buffer);
+		buffer.dump(nested - sizeof(uint16_t) - sizeof(uint32_t));
+	} else if (header.op == SHM_OP && !in_batch) {
+		uint8_t reply[HEADER_SIZE];
+		memcpy(reply, header.req_ident, sizeof(header.req_ident));
+		reply[HEADER_SIZE - 1] = 0;
+		if (buffer.attach_shm(reply, HEADER_SIZE) == -1) {
+			send_err_header(header, buffer);
+		}
+	} else if ((header.op & MATH_OPS) != 0) {
+		math_op = (header.op & MATH_OPS) + (header.op & FINAL_BYTE);
+		fun_index = (math_op & FINAL_BYTE) - 1;
+		if (fun_index < MATH_FUNC_COUNT) {
+			for (size_t i = 0; i < ARG_COUNT && fun_index != -1; ++i) {
+				if ((header.op & FLAGS[i]) != 0) {
+					var_args[i] = (uint8_t*)calloc(SyncHash::DEFAULT_SIZE, sizeof(uint8_t));
+					if (getVarName(buffer, var_args[i]) == -1) {
 						handle_math_arg_error(header, buffer, self, var_args, fun_index);
 					}
-				}
-				//set the arithmetic variable arguments
-				for (size_t i = 0; i < ARG_COUNT - 1  && fun_index != -1; ++i) {
-					if (var_args[i] != nullptr) {
-						if ((header.op & RECURSE) == 0) {
-							//do a simple lookup
-							if (self->hTable->lookup(var_args[i], arith_args[i], self->ident) == -1) {
-								handle_math_arg_error(header, buffer, self, var_args, fun_index);
-							}
-						} else {
-							//do a recursive lookup
-							if (self->hTable->rlookup(var_args[i], arith_args[i], self->ident) == -1) {
-								handle_math_arg_error(header, buffer, self, var_args, fun_index);
-							}
-						}
-					}
-				}
-				if (fun_index != -1) {
-					if (math_fun[fun_index](arith_args[0], arith_args[1], arith_args[2]) == -1) {
+				} else if (i != ARG_COUNT - 1) {
+					if (conv_frm_nbo<int64_t>(buffer, arith_args[i]) == -1) {
 						handle_math_arg_error(header, buffer, self, var_args, fun_index);
-					} else {
-						if (var_args[2] != nullptr) {
-							if (self->hTable->insert(var_args[2], arith_args[2], self->ident) == -1){
-								send_err_header(header, buffer);
-							}
-						}
-						send_math_response(header, buffer, arith_args[2]);
-						self->hTable->release(var_args, ARG_COUNT, self->ident);
-						free_var_args(var_args);
 					}
 				}
-			} else {
-				keyname = (uint8_t*)calloc(SyncHash::DEFAULT_SIZE, sizeof(uint8_t));
-				if (getVarName(buffer, keyname) == -1) {
-					send_err_header(header, buffer);
-					free(keyname);
-					break;
+			}
+			if (var_args[2] != nullptr && fun_index != -1) {
+				//if the result is one of the args then operation must be atomic
+				if(self->hTable->acquire(var_args, ARG_COUNT, self->ident) == -1) {
+					handle_math_arg_error(header, buffer, self, var_args, fun_index);
 				}
-				switch (math_op) {
-					case 0x010f: {// del
-						if (self->hTable->remove(keyname, self->ident) == -1) {
-							send_err_header(header, buffer);
-							free(keyname);
-							break;
+			}
+			//set the arithmetic variable arguments
+			for (size_t i = 0; i < ARG_COUNT - 1  && fun_index != -1; ++i) {
+				if (var_args[i] != nullptr) {
+					if ((header.op & RECURSE) == 0) {
+						//do a simple lookup
+						if (self->hTable->lookup(var_args[i], arith_args[i], self->ident) == -1) {
+							handle_math_arg_error(header, buffer, self, var_args, fun_index);
 						}
-						free(keyname);
-						send_header(header, buffer);
-						break;
-					}
-					case 0x0108: { //getv
-						var_result = (uint8_t*)calloc(SyncHash::DEFAULT_SIZE, sizeof(uint8_t));
-						if (self->hTable->lookup(keyname, var_result, self->ident) == -1) {
-							send_err_header(header, buffer);
-						} else {
-							send_header(header, buffer);
-							var_name_size = strlen((char*)var_result);
-							buffer.pushByte(var_name_size);
-							buffer.pushBytes(var_name_size, var_result);
-							buffer.flush();
+					} else {
+						//do a recursive lookup
+						if (self->hTable->rlookup(var_args[i], arith_args[i], self->ident) == -1) {
+							handle_math_arg_error(header, buffer, self, var_args, fun_index);
 						}
-						free(var_result);
-						free(keyname);
-						break;
 					}
-					case 0x0109: { //setv
-						var_result = (uint8_t*)calloc(SyncHash::DEFAULT_SIZE, sizeof(uint8_t));
-						if (getVarName(buffer, var_result) == -1 ||
-							self->hTable->insert(keyname, var_result, self->ident) == -1) {
+				}
+			}
+			if (fun_index != -1) {
+				if (math_fun[fun_index](arith_args[0], arith_args[1], arith_args[2]) == -1) {
+					handle_math_arg_error(header, buffer, self, var_args, fun_index);
+				} else {
+					if (var_args[2] != nullptr) {
+						if (self->hTable->insert(var_args[2], arith_args[2], self->ident) == -1){
 							send_err_header(header, buffer);
-						} else {
-							send_header(header, buffer);
 						}
-						free(var_result);
-						free(keyname);
-						break;
 					}
-					default:
-						header.err_code = ENOTSUP;
-						send_header(header, buffer);
+					send_math_response(header, buffer, arith_args[2]);
+					self->hTable->release(var_args, ARG_COUNT, self->ident);
+					free_var_args(var_args);
 				}
 			}
 		} else {
-			switch(header.op) {
-				case 0x0201: // read
-				case 0x0202: // write
-					if(conv_frm_nbo<uint16_t>(buffer, filename_size) == -1) {
-						send_err_header(header, buffer);
-						break;
-					}
-					filename = (uint8_t *)calloc(filename_size + 1, sizeof(uint8_t));
-					buffer.getBytes(filename_size, filename);
-					filename[filename_size] = '\0';
-					if (conv_frm_nbo<uint64_t>(buffer, offset) == -1 || 
-						conv_frm_nbo<uint16_t>(buffer, buff_size) == -1) {
-
-						}
-					if((header.op == 0x0201
-							? read_file((char *)filename, offset, buff_size, buffer, header)
-							: write_file((char *)filename, offset, buff_size, buffer, header))
-						== -1) {
-						send_err_header(header, buffer);
-					}
-					free(filename);
-					break;
-				case 0x0210: // create
-					if(conv_frm_nbo<uint16_t>(buffer, filename_size) == -1) {
-						send_err_header(header, buffer);
-						break;
-					}
-					filename = (uint8_t *)calloc(filename_size + 1, sizeof(uint8_t));
-					buffer.getBytes(filename_size, filename);
-					filename[filename_size] = '\0';
-					if(create((char *)filename) == -1) {
-						send_err_header(header, buffer);
-					} else {
-						send_header(header, buffer);
-					}
-					free(filename);
-					break;
-				case 0x0220: // filesize
-					if(conv_frm_nbo<uint16_t>(buffer, filename_size) == -1) {
+			keyname = (uint8_t*)calloc(SyncHash::DEFAULT_SIZE, sizeof(uint8_t));
+			if (getVarName(buffer, keyname) == -1) {
+				send_err_header(header, buffer);
+				free(keyname);
+				return;
+			}
+			switch (math_op) {
+				case 0x010f: {// del
+					if (self->hTable->remove(keyname, self->ident) == -1) {
 						send_err_header(header, buffer);
+						free(keyname);
 						break;
 					}
-					filename = (uint8_t *)calloc(filename_size + 1, sizeof(uint8_t));
-					buffer.getBytes(filename_size, filename);
-					filename[filename_size] = '\0';
-					file_size = filesize((char *)filename);
-					if(file_size == -1) {
-						header.err_code = errno;
-						send_header(header, buffer);
-					} else {
-						send_header(header, buffer);
-						conv_to_nbo<int64_t>(buffer, file_size);
-						buffer.flush();
-					}
-					free(filename);
+					free(keyname);
+					send_header(header, buffer);
 					break;
-				case 0x0301: //dump
-					if(conv_frm_nbo<uint16_t>(buffer, filename_size) == -1) {
+				}
+				case 0x0108: { //getv
+					var_result = (uint8_t*)calloc(SyncHash::DEFAULT_SIZE, sizeof(uint8_t));
+					if (self->hTable->lookup(keyname, var_result, self->ident) == -1) {
 						send_err_header(header, buffer);
-						break;
-					}
-					filename = (uint8_t *)calloc(filename_size + 1, sizeof(uint8_t));
-					buffer.getBytes(filename_size, filename);
-					filename[filename_size] = '\0';
-					if (self->hTable->dump((char*)filename, self->ident) == -1) {
-						header.err_code = errno;
-						send_header(header, buffer);
 					} else {
 						send_header(header, buffer);
+						var_name_size = strlen((char*)var_result);
+						buffer.pushByte(var_name_size);
+						buffer.pushBytes(var_name_size, var_result);
 					}
-					free(filename);
+					free(var_result);
+					free(keyname);
 					break;
-				case 0x0302: //load
-					if(conv_frm_nbo<uint16_t>(buffer, filename_size) == -1) {
+				}
+				case 0x0109: { //setv
+					var_result = (uint8_t*)calloc(SyncHash::DEFAULT_SIZE, sizeof(uint8_t));
+					if (getVarName(buffer, var_result) == -1 ||
+						self->hTable->insert(keyname, var_result, self->ident) == -1) {
 						send_err_header(header, buffer);
-						break;
-					}
-					filename = (uint8_t *)calloc(filename_size + 1, sizeof(uint8_t));
-					buffer.getBytes(filename_size, filename);
-					filename[filename_size] = '\0';
-					if (self->hTable->load((char*)filename, self->ident) == -1) {
-						header.err_code = errno;
-						send_header(header, buffer);
 					} else {
 						send_header(header, buffer);
 					}
-					free(filename);
+					free(var_result);
+					free(keyname);
 					break;
+				}
 				default:
 					header.err_code = ENOTSUP;
 					send_header(header, buffer);
 			}
 		}
+	} else {
+		switch(header.op) {
+			case 0x0201: // read
+			case 0x0202: // write
+				if(conv_frm_nbo<uint16_t>(buffer, filename_size) == -1) {
+					send_err_header(header, buffer);
+					break;
+				}
+				filename = (uint8_t *)calloc(filename_size + 1, sizeof(uint8_t));
+				buffer.getBytes(filename_size, filename);
+				filename[filename_size] = '\0';
+				if (conv_frm_nbo<uint64_t>(buffer, offset) == -1 || 
+					conv_frm_nbo<uint16_t>(buffer, buff_size) == -1) {
+
+					}
+				// io_uring sends straight to the socket, a shared memory client has none
+				ring = buffer.on_socket() ? self->ring : nullptr;
+				if((header.op == 0x0201
+						? read_file((char *)filename, offset, buff_size, buffer, header, ring)
+						: write_file((char *)filename, offset, buff_size, buffer, header, ring,
+							  self->pipe_fds))
+					== -1) {
+					send_err_header(header, buffer);
+				}
+				free(filename);
+				break;
+			case 0x0210: // create
+				if(conv_frm_nbo<uint16_t>(buffer, filename_size) == -1) {
+					send_err_header(header, buffer);
+					break;
+				}
+				filename = (uint8_t *)calloc(filename_size + 1, sizeof(uint8_t));
+				buffer.getBytes(filename_size, filename);
+				filename[filename_size] = '\0';
+				if(create((char *)filename) == -1) {
+					send_err_header(header, buffer);
+				} else {
+					send_header(header, buffer);
+				}
+				free(filename);
+				break;
+			case 0x0220: // filesize
+				if(conv_frm_nbo<uint16_t>(buffer, filename_size) == -1) {
+					send_err_header(header, buffer);
+					break;
+				}
+				filename = (uint8_t *)calloc(filename_size + 1, sizeof(uint8_t));
+				buffer.getBytes(filename_size, filename);
+				filename[filename_size] = '\0';
+				file_size = filesize((char *)filename);
+				if(file_size == -1) {
+					header.err_code = errno;
+					send_header(header, buffer);
+				} else {
+					send_header(header, buffer);
+					conv_to_nbo<int64_t>(buffer, file_size);
+				}
+				free(filename);
+				break;
+			case 0x0301: //dump
+				if(conv_frm_nbo<uint16_t>(buffer, filename_size) == -1) {
+					send_err_header(header, buffer);
+					break;
+				}
+				filename = (uint8_t *)calloc(filename_size + 1, sizeof(uint8_t));
+				buffer.getBytes(filename_size, filename);
+				filename[filename_size] = '\0';
+				if (self->hTable->dump((char*)filename, self->ident) == -1) {
+					header.err_code = errno;
+					send_header(header, buffer);
+				} else {
+					send_header(header, buffer);
+				}
+				free(filename);
+				break;
+			case 0x0302: //load
+				if(conv_frm_nbo<uint16_t>(buffer, filename_size) == -1) {
+					send_err_header(header, buffer);
+					break;
+				}
+				filename = (uint8_t *)calloc(filename_size + 1, sizeof(uint8_t));
+				buffer.getBytes(filename_size, filename);
+				filename[filename_size] = '\0';
+				if (self->hTable->load((char*)filename, self->ident) == -1) {
+					header.err_code = errno;
+					send_header(header, buffer);
+				} else {
+					send_header(header, buffer);
+				}
+				free(filename);
+				break;
+			default:
+				header.err_code = ENOTSUP;
+				send_header(header, buffer);
+		}
 	}
 }
 
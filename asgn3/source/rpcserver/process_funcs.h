@@ -13,6 +13,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "io_ring.h"
+
 typedef struct thread Thread;
 
 template<class var_int_type>
@@ -23,8 +25,10 @@ void build_header(resp_header &, Bounded_Buffer &);
 void send_header(resp_header &, Bounded_Buffer &);
 void send_err_header(resp_header &, Bounded_Buffer &);
 void send_math_response(resp_header &, Bounded_Buffer &, int64_t);
-int64_t read_file(char *, uint64_t, uint16_t, Bounded_Buffer &, resp_header &);
-int64_t write_file(char *, uint64_t, uint16_t, Bounded_Buffer &, resp_header &);
+int64_t read_file(char *, uint64_t, uint16_t, Bounded_Buffer &, resp_header &, IO_Ring *);
+int64_t write_file(char *, uint64_t, uint16_t, Bounded_Buffer &, resp_header &, IO_Ring *, int *);
+int64_t ring_read_file(char *, uint64_t, uint16_t, Bounded_Buffer &, resp_header &, IO_Ring *);
+int64_t ring_write_file(char *, uint64_t, uint16_t, Bounded_Buffer &, resp_header &, IO_Ring *);
 int64_t create(char *);
 int64_t filesize(char *);
 int8_t getVarName(Bounded_Buffer&, uint8_t*);
@@ -34,6 +38,8 @@ void handle_math_arg_error(resp_header&, Bounded_Buffer&, Thread*, uint8_t**&, s
 
 static const int16_t MATH_OPS = 0x0100;
 static const int16_t CLEAR_OP = 0x0310;
+static const int16_t BATCH_OP = 0x0401;
+static const int16_t SHM_OP = 0x0410;
 static const int16_t FINAL_BYTE = 0x000f;
 static const uint32_t CLEAR_CONFIRM = 0x0badbad0;
 static const int16_t VAR_A = 0x10;
@@ -42,32 +48,25 @@ static const int16_t VAR_RES = 0x40;
 static const int16_t RECURSE = 0x80;
 static const size_t ARG_COUNT = 3;
 static const int16_t FLAGS[ARG_COUNT] = {VAR_A, VAR_B, VAR_RES};
+static const size_t HEADER_SIZE = sizeof(uint32_t) + sizeof(uint8_t);
+static const uint16_t SENDFILE_MIN = 4096;
 
 template<class var_int_type>
 void conv_to_nbo(Bounded_Buffer &b_buff, var_int_type to_conv)
 {
-	uint8_t to_push = 0;
 	errno = 0;
-	ssize_t size = sizeof(to_conv) - 1;
-	for(ssize_t i = size; 0 <= i; --i) {
-		to_push = (to_conv >> 8 * i) & 0xFF;
-		if(b_buff.pushByte(to_push) == -1) {
-			// TODO error handling
-		}
+	if(b_buff.pushInt(to_conv) == -1) {
+		// TODO error handling
 	}
 }
 
 template<class var_int_type>
 int8_t conv_frm_nbo(Bounded_Buffer &b_buff, var_int_type& value)
 {
-	value = 0;
-	for(size_t i = 0; i < sizeof(value); ++i) {
-		uint8_t *curr_byte = b_buff.getByte();
-		if(curr_byte == NULL) {
-			errno = EINVAL;
-			return -1;
-		}
-		value = (value << 8) + *curr_byte;
+	if(b_buff.getInt(value) == -1) {
+		value = 0;
+		errno = EINVAL;
+		return -1;
 	}
 	return 0;
 }
@@ -83,16 +82,17 @@ void build_header(resp_header &header, Bounded_Buffer &b_buff)
 	header.err_code = 0;
 }
 
+/**
+ * send_header
+ * Queues the response header behind any earlier responses. Responses
+ * are flushed together once the worker runs out of pipelined requests.
+ **/
 void send_header(resp_header &header, Bounded_Buffer &b_buff)
 {
-	b_buff.clear();
 	b_buff.pushBytes(sizeof(uint32_t), header.req_ident);
 	if(b_buff.client_fd == 0)
 		return;
 	b_buff.pushByte(header.err_code);
-	if(b_buff.client_fd == 0)
-		return;
-	b_buff.flush();
 }
 
 void send_err_header(resp_header &header, Bounded_Buffer &b_buff) {
@@ -108,18 +108,20 @@ void send_math_response(resp_header &header, Bounded_Buffer &b_buff, int64_t dat
 	if(b_buff.client_fd == 0)
 		return;
 	conv_to_nbo(b_buff, data);
-	b_buff.flush();
 }
 
 int64_t read_file(char *filename,
   uint64_t offset,
   uint16_t bufsize,
   Bounded_Buffer &b_buff,
-  resp_header &header)
+  resp_header &header,
+  IO_Ring *ring)
 {
+	if(ring != nullptr) {
+		return ring_read_file(filename, offset, bufsize, b_buff, header, ring);
+	}
 	int file_d = open(filename, O_RDONLY | O_EXCL);
 	if(file_d == -1) {
-		b_buff.dump(bufsize);
 		return -1;
 	}
 	int64_t file_size = filesize(filename);
@@ -132,13 +134,16 @@ int64_t read_file(char *filename,
 		errno = EINVAL;
 		return -1;
 	}
-	if(lseek(file_d, offset, SEEK_SET) == -1) {
+	// small reads are cheaper to copy into the batch than to sendfile
+	bool copy = bufsize < SENDFILE_MIN;
+	if(copy && lseek(file_d, offset, SEEK_SET) == -1) {
 		close(file_d);
 		return -1;
 	}
 	send_header(header, b_buff);
 	conv_to_nbo<uint16_t>(b_buff, bufsize);
-	int64_t bytes_read = b_buff.from_file(file_d, bufsize);
+	int64_t bytes_read
+	  = copy ? b_buff.from_file(file_d, bufsize) : b_buff.send_file(file_d, offset, bufsize);
 	close(file_d);
 	if(bytes_read == -1)
 		return -1;
@@ -149,8 +154,13 @@ int64_t write_file(char *filename,
   uint64_t offset,
   uint16_t bufsize,
   Bounded_Buffer &b_buff,
-  resp_header &header)
+  resp_header &header,
+  IO_Ring *ring,
+  int *pipe_fds)
 {
+	if(ring != nullptr) {
+		return ring_write_file(filename, offset, bufsize, b_buff, header, ring);
+	}
 	int file_d = open(filename, O_WRONLY | O_EXCL);
 	if(file_d == -1) {
 		b_buff.dump(bufsize);
@@ -158,9 +168,12 @@ int64_t write_file(char *filename,
 	}
 	if(lseek(file_d, offset, SEEK_SET) == -1) {
 		close(file_d);
+		b_buff.dump(bufsize);
 		return -1;
 	}
-	int64_t bytes_written = b_buff.to_file(file_d, bufsize);
+	int64_t bytes_written = pipe_fds[0] != -1
+	  ? b_buff.splice_to_file(file_d, bufsize, pipe_fds)
+	  : b_buff.to_file(file_d, bufsize);
 	close(file_d);
 	if(bytes_written == -1)
 		return -1;
@@ -168,6 +181,72 @@ int64_t write_file(char *filename,
 	return bytes_written;
 }
 
+/**
+ * ring_read_file
+ * Stages the response header and data size in the ring's registered
+ * buffer and lets one io_uring chain open, read, send and close. The
+ * header only goes out once the whole range was read.
+ **/
+int64_t ring_read_file(char *filename,
+  uint64_t offset,
+  uint16_t bufsize,
+  Bounded_Buffer &b_buff,
+  resp_header &header,
+  IO_Ring *ring)
+{
+	uint8_t *head = ring->buffer();
+	size_t head_size = HEADER_SIZE + sizeof(bufsize);
+	memcpy(head, header.req_ident, sizeof(uint32_t));
+	head[sizeof(uint32_t)] = header.err_code;
+	head[HEADER_SIZE] = bufsize >> 8;
+	head[HEADER_SIZE + 1] = bufsize & 0xFF;
+	// earlier responses in the batch go out first
+	if(b_buff.flush(true) == -1) {
+		return -1;
+	}
+	ssize_t bytes_sent = ring->send_file(filename, offset, bufsize, b_buff.client_fd, head_size);
+	if(bytes_sent == -1) {
+		return -1;
+	}
+	if(b_buff.send_bytes(head + bytes_sent, head_size + bufsize - bytes_sent) == -1) {
+		return -1;
+	}
+	return bufsize;
+}
+
+/**
+ * ring_write_file
+ * Collects the payload in the ring's registered buffer with the response
+ * header behind it, then lets one io_uring chain open, write, close and
+ * send the header.
+ **/
+int64_t ring_write_file(char *filename,
+  uint64_t offset,
+  uint16_t bufsize,
+  Bounded_Buffer &b_buff,
+  resp_header &header,
+  IO_Ring *ring)
+{
+	uint8_t *data = ring->buffer();
+	if(b_buff.getBytes(bufsize, data) == -1) {
+		return -1;
+	}
+	uint8_t *reply = data + bufsize;
+	memcpy(reply, header.req_ident, sizeof(uint32_t));
+	reply[sizeof(uint32_t)] = header.err_code;
+	if(b_buff.flush(true) == -1) {
+		return -1;
+	}
+	ssize_t bytes_sent = ring->write_file(filename, offset, bufsize, b_buff.client_fd, HEADER_SIZE);
+	if(bytes_sent == -1) {
+		return -1;
+	}
+	if(b_buff.send_bytes(reply + bytes_sent, HEADER_SIZE - bytes_sent) == -1) {
+		return -1;
+	}
+	return bufsize;
+}
+
 int64_t create(char *filename)
 {
 	int fd = open(filename, O_RDWR | O_CREAT | O_EXCL, S_IRWXU);
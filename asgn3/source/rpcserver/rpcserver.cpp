@@ -11,27 +11,56 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "placement.h"
 #include "sync_hash.h"
 #include "structs.h"
 #include "process.h"
 
 const int16_t MAX_HOSTNAME_SIZE = 1000;
 const int16_t MIN_PORT_VAL = 1024;
+const int MAX_EVENTS = 64;
+const size_t READY_QUEUE_SIZE = 4096;
+const uint32_t CLIENT_EVENTS = EPOLLIN | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+//pool scaling: grow when each worker has this many connections queued
+const size_t SPAWN_BACKLOG = 4;
+//or when a connection waited this long for a worker
+const uint64_t SPAWN_WAIT_NS = 2000000;
+//at most one new worker per interval
+const uint64_t SPAWN_INTERVAL_NS = 10000000;
+//workers above the minimum retire after idling this long
+const struct timespec IDLE_TIMEOUT = {5, 0};
 
 typedef struct thread Thread;
+typedef struct listener Listener;
 
 void* start(void* arg);
-int getWorker(Thread*, const int&);
+void* event_loop(void* arg);
+connection* next_connection(Thread*);
+void accept_clients(Listener*);
+void init_listener(Listener*, struct sockaddr*, socklen_t, bool);
+void init_workers(Listener*, int, int, SyncHash*, bool);
+bool spawn_worker(Listener*, bool);
+bool retire_worker(Thread*);
+size_t backlog(Listener*);
+bool shed_connection(Listener*, connection*);
+void rearm(int, connection*);
+uint64_t now_ns();
+void report(Listener*, int);
 
 int main(int argc, char *argv[])
 {
@@ -41,18 +70,26 @@ int main(int argc, char *argv[])
 	strcpy((char*)data_dir, "data");
 	uint16_t port = 0;
 	uint16_t recur = 50;
-	int num_threads = 4, cl = 0, htable_size = 32, opt, worker;
+	bool use_ring = false, pin_workers = false, numa_table = false, lock_free = false;
+	Hash::Backend backend = Hash::CHAINED;
+	int num_threads = 4, max_threads = 0, num_listeners = 1, htable_size = 32, opt, sig;
+	size_t max_backlog = 0;
+	char* unix_path = nullptr;
+	uint64_t max_delay_ms = 0;
 	SyncHash* hTable;
-	Thread* threads;
+	Listener* listeners;
 	pthread_t dummy_addr;
-	sem_t mainMutex;
+	sigset_t report_sigs;
 
 	//handle command line args
-	while ((opt = getopt(argc, argv, "N:H:I:d:")) != -1) {
+	while ((opt = getopt(argc, argv, "N:M:H:I:d:RA:PUQ:W:u:T:")) != -1) {
 		switch (opt) {
 		case 'N':
 			num_threads = atoi(optarg);
 			break;
+		case 'M':
+			max_threads = atoi(optarg);
+			break;
 		case 'H':
 			htable_size = atoi(optarg);
 			break;
@@ -65,10 +102,61 @@ int main(int argc, char *argv[])
 			}
 			strcpy((char*)data_dir, (char*)optarg);
 			break;
+		case 'R':
+			use_ring = true;
+			break;
+		case 'P':
+			pin_workers = true;
+			break;
+		case 'U':
+			numa_table = true;
+			break;
+		case 'Q':
+			max_backlog = strtoul(optarg, NULL, 10);
+			break;
+		case 'W':
+			max_delay_ms = strtoul(optarg, NULL, 10);
+			break;
+		case 'u':
+			unix_path = optarg;
+			break;
+		case 'T':
+			if (strcmp(optarg, "chain") == 0) {
+				backend = Hash::CHAINED;
+			} else if (strcmp(optarg, "swiss") == 0) {
+				backend = Hash::SWISS;
+			} else if (strcmp(optarg, "lockfree") == 0) {
+				lock_free = true;
+			} else {
+				errx(EXIT_FAILURE, "-T must be chain, swiss or lockfree");
+			}
+			break;
+		case 'A':
+			num_listeners = atoi(optarg);
+			if (num_listeners < 1) {
+				errx(EXIT_FAILURE, "-A must be at least 1");
+			}
+			break;
 		default: /* '?' */
 			break;
 		}
 	}
+	if (num_threads < 1) {
+		errx(EXIT_FAILURE, "-N must be at least 1");
+	}
+	//without -M the pool stays at -N workers
+	if (max_threads == 0) {
+		max_threads = num_threads;
+	} else if (max_threads < num_threads) {
+		errx(EXIT_FAILURE, "-M must be at least -N");
+	}
+	//workers tell the lock-free table apart by ident, one per worker slot
+	//of every listener and the unix socket
+	if (lock_free && (int64_t)(num_listeners + (unix_path != nullptr ? 1 : 0)) * max_threads
+	  > (int64_t)Epoch::MAX_IDENTS) {
+		errx(EXIT_FAILURE, "-T lockfree allows at most %zu workers across all listeners",
+		  Epoch::MAX_IDENTS);
+	}
 	if (argv[optind] == nullptr) {
 		errx(EXIT_FAILURE, "Usage: ./rpcserver <host_name>:<port>");
 	}
@@ -83,72 +171,476 @@ int main(int argc, char *argv[])
 		errx(EXIT_FAILURE, "Port must be > %d", MIN_PORT_VAL);
 	}
 
-	hTable = new SyncHash(htable_size, recur, (char*) data_dir);
-
-	//init threads
-	//some code below sourced from https://piazza.com/class/kex6x7ets2p35c?cid=291 11/18/2020
-	threads = (Thread*)calloc(num_threads, sizeof(Thread));
-	
-	if (0 != sem_init(&mainMutex, 0, 0)) err(2,"sem_init mainMutex");
-
-	for (int i = 0; i < num_threads; ++i) {
-		Thread* thread = &threads[i];
-		thread->cl = 0;
-		thread->mainMutex = &mainMutex;
-		thread->hTable = hTable;
-		thread->ident = i;
-        if (0 != pthread_create(&dummy_addr,0,start,thread)) err(2,"pthread_create");
+	hTable = new SyncHash(htable_size, recur, (char*) data_dir, backend, lock_free);
+	if (numa_table) {
+		hTable->interleave_memory();
 	}
 
+	//SIGUSR1 prints the listener statistics, it is only taken by sigwait below
+	sigemptyset(&report_sigs);
+	sigaddset(&report_sigs, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &report_sigs, NULL);
+
 	//init network
 	/* Sourced from:
 	 * https://canvas.ucsc.edu/courses/36179/pages/setting-up-sockets-for-basic-client-slash-server-stream-communication
 	 */
 	struct hostent *hent = gethostbyname(host_name);
+	if (hent == nullptr) {
+		errx(EXIT_FAILURE, "%s: unknown host", host_name);
+	}
 	struct sockaddr_in addr;
 	memcpy(&addr.sin_addr.s_addr, hent->h_addr, hent->h_length);
 	addr.sin_port = htons(port);
 	addr.sin_family = AF_INET;
-	int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+	struct sockaddr_un unix_addr;
+	memset(&unix_addr, 0, sizeof(unix_addr));
+	unix_addr.sun_family = AF_UNIX;
+	if (unix_path != nullptr && strlen(unix_path) >= sizeof(unix_addr.sun_path)) {
+		errx(EXIT_FAILURE, "%s: socket path too long", unix_path);
+	}
+
+	//each listener gets its own SO_REUSEPORT socket, event loop and workers,
+	//the unix socket listener for local clients comes last
+	int num_sockets = num_listeners + (unix_path != nullptr ? 1 : 0);
+	listeners = new Listener[num_sockets];
+	for (int i = 0; i < num_sockets; ++i) {
+		listeners[i].ident = i;
+		listeners[i].accepted = 0;
+		listeners[i].pin_workers = pin_workers;
+		listeners[i].max_backlog = max_backlog;
+		listeners[i].max_delay_ns = max_delay_ms * 1000000;
+		listeners[i].shed = 0;
+		if (i < num_listeners) {
+			init_listener(&listeners[i], (struct sockaddr*)&addr, sizeof(addr), num_listeners > 1);
+		} else {
+			strcpy(unix_addr.sun_path, unix_path);
+			//a socket file left behind by an earlier run would make bind fail
+			unlink(unix_path);
+			init_listener(&listeners[i], (struct sockaddr*)&unix_addr, sizeof(unix_addr), false);
+		}
+		init_workers(&listeners[i], num_threads, max_threads, hTable, use_ring);
+		if (0 != pthread_create(&dummy_addr, 0, event_loop, &listeners[i])) err(2,"pthread_create");
+	}
+
+	while (true) {
+		if (sigwait(&report_sigs, &sig) == 0) {
+			report(listeners, num_sockets);
+		}
+	}
+	return 0;
+}
+
+/**
+ * init_listener
+ * @param self: listener to open the socket for
+ * @param addr: address to bind to, AF_INET or AF_UNIX
+ * @param addr_len: size of addr
+ * @param reuseport: share the address with the other listeners
+ *
+ * Opens the non-blocking listening socket and the event loop watching it.
+ * With SO_REUSEPORT the kernel spreads new connections over the listeners.
+ **/
+void init_listener(Listener* self, struct sockaddr* addr, socklen_t addr_len, bool reuseport) {
 	int enable = 1;
-	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
-	if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+	self->family = addr->sa_family;
+	self->sock = socket(self->family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (self->sock == -1)
+		err(EXIT_FAILURE, "%s", strerror(errno));
+	if (self->family == AF_INET)
+		setsockopt(self->sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	if (reuseport && setsockopt(self->sock, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1)
+		err(EXIT_FAILURE, "%s", strerror(errno));
+	if(bind(self->sock, addr, addr_len) == -1)
 		err(EXIT_FAILURE, "%s\n", strerror(errno));
-	listen(sock, 128);
+	listen(self->sock, 128);
+
+	self->epoll_fd = epoll_create1(0);
+	if (self->epoll_fd == -1) err(EXIT_FAILURE, "epoll_create1");
+	//the listening socket is the only entry without a connection attached
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = nullptr;
+	if(epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->sock, &ev) == -1)
+		err(EXIT_FAILURE, "%s", strerror(errno));
+}
+
+/**
+ * init_workers
+ * @param self: listener the workers serve
+ * @param min_threads: workers that always run
+ * @param max_threads: most workers the pool grows to under load
+ * @param hTable: table shared by every worker
+ * @param use_ring: give each worker an io_uring for the file opcodes
+ *
+ * Sets up a slot for every worker the pool may ever run, so a spawned
+ * worker only needs its thread. Only min_threads are started here.
+ **/
+void init_workers(Listener* self, int min_threads, int max_threads, SyncHash* hTable, bool use_ring) {
+	//init threads
+	//some code below sourced from https://piazza.com/class/kex6x7ets2p35c?cid=291 11/18/2020
+	Thread* threads = (Thread*)calloc(max_threads, sizeof(Thread));
+	self->workers = threads;
+	self->min_workers = min_threads;
+	self->num_workers = max_threads;
+	self->live = 0;
+	self->spawned = 0;
+	self->retired = 0;
+	self->last_spawn = 0;
+	pthread_mutex_init(&self->spawn_lock, NULL);
+	self->ready = new MPMC_Queue<connection*>(READY_QUEUE_SIZE);
+
+	for (int i = 0; i < max_threads; ++i) {
+		Thread* thread = &threads[i];
+		thread->conn = nullptr;
+		thread->epoll_fd = self->epoll_fd;
+		thread->ready = self->ready;
+		thread->deque = new Work_Deque<connection*>();
+		thread->workers = threads;
+		thread->group = self;
+		thread->num_workers = max_threads;
+		thread->var_args = (uint8_t**)calloc(ARG_COUNT, sizeof(uint8_t*));
+		thread->hTable = hTable;
+		thread->ring = nullptr;
+		if (use_ring) {
+			thread->ring = new IO_Ring();
+			if (!thread->ring->ready()) {
+				//io_uring is unavailable, the file opcodes use plain syscalls
+				if (i == 0) warn("io_uring unavailable: %s", strerror(errno));
+				delete thread->ring;
+				thread->ring = nullptr;
+			}
+		}
+		//uploads are spliced from the socket into the file through this pipe
+		if (pipe2(thread->pipe_fds, O_CLOEXEC) == -1) {
+			warn("pipe2: %s", strerror(errno));
+			thread->pipe_fds[0] = thread->pipe_fds[1] = -1;
+		}
+		//idents are used as lock owners in the table, keep them unique across listeners
+		thread->ident = self->ident * max_threads + i;
+		thread->active = false;
+	}
+	//workers steal from each other, so every deque must exist before any worker runs
+	for (int i = 0; i < min_threads; ++i) {
+		spawn_worker(self, true);
+	}
+}
+
+/**
+ * spawn_worker
+ * @param self: listener to add a worker to
+ * @param force: skip the rate limit, used for the minimum workers
+ * @return: true if a worker was started
+ *
+ * Starts a worker in a free slot unless the pool is at its maximum or
+ * another worker was started within SPAWN_INTERVAL_NS.
+ **/
+bool spawn_worker(Listener* self, bool force) {
+	pthread_t dummy_addr;
+	uint64_t now = now_ns();
+	if (self->live.load(std::memory_order_relaxed) >= self->num_workers
+		|| (!force && now - self->last_spawn.load(std::memory_order_relaxed) < SPAWN_INTERVAL_NS)) {
+		return false;
+	}
+	pthread_mutex_lock(&self->spawn_lock);
+	bool started = false;
+	for (int i = 0; i < self->num_workers && !started; ++i) {
+		Thread* thread = &self->workers[i];
+		if (thread->active.load(std::memory_order_acquire)) {
+			continue;
+		}
+		thread->active.store(true, std::memory_order_relaxed);
+		self->live.fetch_add(1, std::memory_order_relaxed);
+		if (0 != pthread_create(&dummy_addr, 0, start, thread)) err(2, "pthread_create");
+		pthread_detach(dummy_addr);
+		started = true;
+	}
+	if (started) {
+		self->last_spawn.store(now, std::memory_order_relaxed);
+		if (!force) {
+			self->spawned.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	pthread_mutex_unlock(&self->spawn_lock);
+	return started;
+}
+
+/**
+ * retire_worker
+ * @param self: idle worker
+ * @return: true if the worker should exit
+ *
+ * Leaves the pool unless it is at its minimum. The worker's deque is
+ * empty, it only waits once it has nothing left. The slot stays taken
+ * until the worker clears active on its way out, see start().
+ **/
+bool retire_worker(Thread* self) {
+	Listener* group = self->group;
+	int live = group->live.load(std::memory_order_relaxed);
+	while (live > group->min_workers) {
+		if (group->live.compare_exchange_weak(live, live - 1, std::memory_order_relaxed)) {
+			group->retired.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * backlog
+ * @return: connections waiting in the ready queue and in the worker deques
+ **/
+size_t backlog(Listener* self) {
+	size_t waiting = self->ready->size();
+	for (int i = 0; i < self->num_workers; ++i) {
+		waiting += self->workers[i].deque->size();
+	}
+	return waiting;
+}
+
+/**
+ * shed_connection
+ * @param group: listener over its admission limits
+ * @param conn: connection with requests waiting
+ * @return: false if a request could not be shed without blocking and
+ *          the connection must be run as usual
+ *
+ * Answers every whole request the client has sent with EBUSY, then
+ * hands the connection back to the event loop. Runs on the event loop,
+ * so nothing here may wait on the client: replies the socket can not
+ * take at once are left queued for the worker the connection goes to.
+ **/
+bool shed_connection(Listener* group, connection* conn) {
+	Bounded_Buffer& buffer = conn->buffer;
+	bool more;
+	while ((more = buffer.request_ready(request_size)) && shed_request(buffer)) {
+		group->shed.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (buffer.client_fd != 0 && (more || buffer.flush_now() == -1)) {
+		return false;
+	}
+	if (buffer.client_fd == 0) {
+		delete conn;
+	} else {
+		rearm(group->epoll_fd, conn);
+	}
+	return true;
+}
+
+/**
+ * rearm
+ * Hands an idle connection back to the event loop. A connection that
+ * moved to shared memory is watched through its channel from then on,
+ * its socket stays disarmed.
+ **/
+void rearm(int epoll_fd, connection* conn) {
+	struct epoll_event ev;
+	ev.events = CLIENT_EVENTS;
+	ev.data.ptr = conn;
+	int fd = conn->buffer.watch_fd();
+	conn->buffer.park();
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1
+		&& (errno != ENOENT || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)) {
+		err(2, "epoll_ctl in thread");
+	}
+}
+
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * event_loop
+ * Accepts new clients on the listener's socket and hands connections
+ * with waiting requests to its worker group.
+ **/
+void* event_loop(void* arg) {
+	Listener* self = (Listener*) arg;
+	struct epoll_event events[MAX_EVENTS];
+	connection* conn;
+	int num_events;
+	size_t waiting;
 	while(true) {
-		cl = accept(sock, NULL, NULL);
-		if(cl == -1) {
+		num_events = epoll_wait(self->epoll_fd, events, MAX_EVENTS, -1);
+		if(num_events == -1) {
+			if(errno == EINTR)
+				continue;
 			err(EXIT_FAILURE, "%s", strerror(errno));
 		}
-		while((worker = getWorker(threads, num_threads))==-1) {
-			if (0 != sem_wait(&mainMutex)) err(2,"sem_wait in main");
+		waiting = self->max_backlog > 0 ? backlog(self) : 0;
+		for(int i = 0; i < num_events; ++i) {
+			conn = (connection*)events[i].data.ptr;
+			if(conn == nullptr) {
+				accept_clients(self);
+				continue;
+			}
+			//past the admission limit the requests are answered with EBUSY right here
+			if(self->max_backlog > 0 && waiting >= self->max_backlog && shed_connection(self, conn)) {
+				continue;
+			}
+			conn->queued_at = now_ns();
+			self->ready->push_wait(conn);
+			++waiting;
+		}
+		//nobody is parked and the queues keep growing, add a worker
+		if(self->num_workers > self->min_workers && !self->ready->has_sleepers()
+			&& backlog(self) >= SPAWN_BACKLOG * self->live.load(std::memory_order_relaxed)) {
+			spawn_worker(self, false);
 		}
-		threads[worker].cl = cl;
-		if (0 != sem_post(&(threads[worker].mutex))) err(2,"sem_post for thread"); 
 	}
-	return 0;
 }
 
+/**
+ * report
+ * Prints how many connections each listener has accepted and how its
+ * worker pool has scaled
+ **/
+void report(Listener* listeners, int num_listeners) {
+	uint64_t total = 0, accepted;
+	for (int i = 0; i < num_listeners; ++i) {
+		accepted = listeners[i].accepted.load(std::memory_order_relaxed);
+		total += accepted;
+		fprintf(stderr, "listener %d (%s): %lu accepted, %d workers, %lu spawned, %lu retired, %lu shed\n",
+		  i, listeners[i].family == AF_UNIX ? "unix" : "tcp", accepted, listeners[i].live.load(std::memory_order_relaxed),
+		  listeners[i].spawned.load(std::memory_order_relaxed),
+		  listeners[i].retired.load(std::memory_order_relaxed),
+		  listeners[i].shed.load(std::memory_order_relaxed));
+	}
+	fprintf(stderr, "total: %lu accepted\n", total);
+}
+
+/**
+ * accept_clients
+ * @param self: listener with clients waiting to be accepted
+ *
+ * Accepts every pending client. Clients are registered one-shot so that
+ * only one worker at a time can own a connection.
+ **/
+void accept_clients(Listener* self) {
+	struct epoll_event ev;
+	int cl, one = 1;
+	while((cl = accept4(self->sock, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+		self->accepted.fetch_add(1, std::memory_order_relaxed);
+		connection* conn = new connection;
+		conn->buffer.client_fd = cl;
+		//batched responses are sent with MSG_MORE, the last one must not wait on Nagle
+		if(self->family == AF_INET
+			&& setsockopt(cl, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1) {
+			warn("%s", strerror(errno));
+		}
+		ev.events = CLIENT_EVENTS;
+		ev.data.ptr = conn;
+		if(epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, cl, &ev) == -1) {
+			warn("%s", strerror(errno));
+			//the buffer does not own the descriptor
+			close(cl);
+			delete conn;
+		}
+	}
+	if(errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR) {
+		err(EXIT_FAILURE, "%s", strerror(errno));
+	}
+}
 
+/**
+ * start
+ * Worker loop. Connections are scheduled one request at a time: a
+ * connection with more requests waiting goes back on this worker's deque
+ * where it takes its turn behind the others and can be stolen by an idle
+ * worker. A connection sits in exactly one queue or worker at a time,
+ * so its responses keep their order. Workers never wait on a client
+ * that has only sent part of a request, so a few workers can keep
+ * many slow connections in flight.
+ **/
 void* start(void* arg) {
 	Thread* self = (Thread*) arg;
+	//a slot always lands on the same core, so its memory can follow it
+	if (self->group->pin_workers) {
+		if (pin_thread(self->ident) == -1) {
+			warn("pin_thread: %s", strerror(errno));
+		} else if (self->ring != nullptr) {
+			bind_local(self->ring->buffer(), IO_Ring::BUFFER_SIZE);
+		}
+	}
 	while (true) { 
-		while(self->cl == 0) { 
-			if (0 != sem_wait(&self->mutex)) { 
-				err(2, "sem_wait in thread"); 
-			} 
+		connection* conn = next_connection(self);
+		if (conn == nullptr) {
+			//a new worker may take the slot as soon as this is clear, so
+			//nothing may touch self after it
+			self->active.store(false, std::memory_order_release);
+			return NULL;
+		}
+		self->conn = conn;
+		//connections are waiting on workers, add one
+		uint64_t waited = now_ns() - self->conn->queued_at;
+		if (waited > SPAWN_WAIT_NS) {
+			spawn_worker(self->group, false);
+		}
+		//the client already waited too long, tell it to go elsewhere
+		if (self->group->max_delay_ns > 0 && waited > self->group->max_delay_ns
+			&& shed_connection(self->group, self->conn)) {
+			self->conn = nullptr;
+			continue;
+		}
+		Bounded_Buffer& buffer = self->conn->buffer;
+		//only whole requests are processed, a partial one waits in epoll
+		bool more = buffer.request_ready(request_size);
+		if (more) {
+			process(self);
+			more = buffer.request_ready(request_size);
+		}
+		//responses are batched until the pipelined requests run out
+		if (!more && buffer.client_fd != 0) {
+			buffer.flush();
+		}
+		if (self->conn->buffer.client_fd == 0) {
+			delete self->conn;
+		} else if (more) {
+			//give parked workers the connection directly, they do not scan the deques
+			self->conn->queued_at = now_ns();
+			if (self->ready->has_sleepers() || !self->deque->push(self->conn)) {
+				self->ready->push_wait(self->conn);
+			}
+		} else {
+			rearm(self->epoll_fd, self->conn);
 		}
-		process(self);
-		self->cl = 0;
-		if (0 != sem_post(self->mainMutex)) err(2, "sem_post of main in thread");
+		self->conn = nullptr;
 	}
 }
 
-int getWorker(Thread* threads, const int& num_threads) {
-	for (int i = 0; i < num_threads; ++i) {
-		if (threads[i].cl == 0) {
-			return i;
+/**
+ * next_connection
+ * @param self: worker looking for work
+ * @return: connection with a request waiting, nullptr if the worker
+ *          idled out and retired
+ *
+ * Newly ready connections come first, then this worker's own deque,
+ * then the other workers' deques. Parks on the ready queue when there
+ * is nothing to run.
+ **/
+connection* next_connection(Thread* self) {
+	connection* conn;
+	//only workers above the minimum can time out and retire
+	const struct timespec* timeout
+	  = self->group->num_workers > self->group->min_workers ? &IDLE_TIMEOUT : NULL;
+	while (true) {
+		if (self->ready->pop(conn) || self->deque->steal(conn)) {
+			return conn;
+		}
+		for (int i = 1; i < self->num_workers; ++i) {
+			Thread* victim = &self->workers[(self->ident + i) % self->num_workers];
+			if (victim->deque->steal(conn)) {
+				return conn;
+			}
+		}
+		if (self->ready->pop_wait(conn, timeout)) {
+			return conn;
+		}
+		if (retire_worker(self)) {
+			return nullptr;
 		}
 	}
-	return -1;
-}
\ No newline at end of file
+}
@@ -9,11 +9,16 @@
  * @date 11/18/2020
  **/
 
+#include <atomic>
 #include <inttypes.h>
 #include <pthread.h>
 #include <semaphore.h>
 
+#include "bounded_buffer.h"
+#include "io_ring.h"
+#include "mpmc_queue.h"
 #include "sync_hash.h"
+#include "work_deque.h"
 
 
 struct resp_header {
@@ -22,11 +27,50 @@ struct resp_header {
 	uint8_t err_code = 0;
 };
 
+struct connection {
+	Bounded_Buffer buffer;
+	// when the connection was last queued for a worker, in nanoseconds
+	uint64_t queued_at;
+};
+
 struct thread {
-	sem_t* mainMutex;
-	sem_t mutex;
+	MPMC_Queue<connection*>* ready;
+	Work_Deque<connection*>* deque;
+	struct thread* workers;
+	struct listener* group;
 	SyncHash* hTable; 
-	int cl;
+	IO_Ring* ring;
+	connection* conn;
+	uint8_t** var_args;
+	int pipe_fds[2];
+	int num_workers;
+	int epoll_fd;
+	int64_t ident;
+	// the slot is running a worker, slots are reused after a retirement
+	std::atomic<bool> active;
+};
+
+// a listening socket with its own event loop and worker group
+struct listener {
+	struct thread* workers;
+	MPMC_Queue<connection*>* ready;
+	std::atomic<uint64_t> accepted;
+	// the pool grows from min_workers up to num_workers under load
+	std::atomic<int> live;
+	std::atomic<uint64_t> spawned;
+	std::atomic<uint64_t> retired;
+	std::atomic<uint64_t> last_spawn;
+	pthread_mutex_t spawn_lock;
+	// admission limits, 0 when unlimited
+	size_t max_backlog;
+	uint64_t max_delay_ns;
+	std::atomic<uint64_t> shed;
+	bool pin_workers;
+	int min_workers;
+	int num_workers;
+	int family;
+	int sock;
+	int epoll_fd;
 	int64_t ident;
 };
 
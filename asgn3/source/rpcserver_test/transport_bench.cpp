@@ -0,0 +1,198 @@
+/**
+ * Transport latency benchmark
+ *
+ * Sends add requests one at a time to a running rpcserver, over
+ * loopback TCP, over its unix domain socket (-u) and over a shared
+ * memory channel attached through that socket, and reports the round
+ * trip latency of each.
+ *
+ * usage: ./transport_bench <host_name>:<port> <socket_path> [requests]
+ *
+ * @author Perry David Ralston Jr
+ * @date 12/13/2020
+ */
+
+#include <algorithm>
+#include <err.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "shm_channel.h"
+
+// add, ident, two int64 operands
+static const size_t REQUEST_SIZE = 2 + 4 + 8 + 8;
+// ident, error code, int64 result
+static const size_t RESPONSE_SIZE = 4 + 1 + 8;
+
+int connect_tcp(const char *target)
+{
+	char host_name[1000];
+	uint16_t port;
+	if(sscanf(target, "%999[^:]:%hu", host_name, &port) < 2)
+		errx(2, "Argument format <host_name>:<port>");
+	struct hostent *hent = gethostbyname(host_name);
+	if(hent == nullptr)
+		errx(2, "%s: unknown host", host_name);
+	struct sockaddr_in addr;
+	memcpy(&addr.sin_addr.s_addr, hent->h_addr, hent->h_length);
+	addr.sin_port = htons(port);
+	addr.sin_family = AF_INET;
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		err(2, "connect %s", target);
+	int one = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return sock;
+}
+
+int connect_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		err(2, "connect %s", path);
+	return sock;
+}
+
+/**
+ * attach_shm
+ * @return: client side of a shared memory channel on the connection
+ **/
+Shm_Channel *attach_shm(int sock)
+{
+	uint8_t request[] = {0x04, 0x10, 0, 0, 0, 0};
+	uint8_t reply[4 + 1];
+	if(send(sock, request, sizeof(request), 0) != (ssize_t)sizeof(request))
+		err(2, "send");
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * Shm_Channel::SHARED_FDS)];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {reply, sizeof(reply)};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	if(recvmsg(sock, &msg, MSG_WAITALL) != (ssize_t)sizeof(reply))
+		err(2, "recvmsg");
+	if(reply[4] != 0)
+		errx(2, "attach refused: %s", strerror(reply[4]));
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if(cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+		errx(2, "attach reply carries no descriptors");
+	int fds[Shm_Channel::SHARED_FDS];
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	Shm_Channel *shm = Shm_Channel::attach(sock, fds);
+	if(shm == nullptr)
+		err(2, "attach");
+	return shm;
+}
+
+void send_all(int sock, Shm_Channel *shm, const uint8_t *bytes, size_t size)
+{
+	if(shm == nullptr) {
+		if(send(sock, bytes, size, 0) != (ssize_t)size)
+			err(2, "send");
+		return;
+	}
+	size_t sent = 0;
+	while((sent += shm->write(bytes + sent, size - sent)) < size) {
+		if(shm->wait(true) == -1)
+			errx(2, "server hung up");
+	}
+}
+
+void recv_all(int sock, Shm_Channel *shm, uint8_t *bytes, size_t size)
+{
+	size_t got = 0;
+	while(got < size) {
+		if(shm != nullptr) {
+			size_t curr = shm->read(bytes + got, size - got);
+			if(curr == 0 && shm->wait(false) == -1)
+				errx(2, "server hung up");
+			got += curr;
+			continue;
+		}
+		ssize_t curr = recv(sock, bytes + got, size - got, 0);
+		if(curr <= 0)
+			errx(2, "server hung up");
+		got += curr;
+	}
+}
+
+/**
+ * run
+ * @param shm: channel to use instead of the socket, nullptr for none
+ * @return: latencies of every request in microseconds, sorted
+ **/
+double *run(int sock, Shm_Channel *shm, int requests)
+{
+	uint8_t request[REQUEST_SIZE] = {0x01, 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 2};
+	uint8_t response[RESPONSE_SIZE];
+	double *latency = (double *)calloc(requests, sizeof(double));
+	for(int i = 0; i < requests; ++i) {
+		request[5] = i & 0xFF;
+		double begin = now();
+		send_all(sock, shm, request, REQUEST_SIZE);
+		recv_all(sock, shm, response, RESPONSE_SIZE);
+		latency[i] = (now() - begin) * 1e6;
+		if(response[3] != (i & 0xFF) || response[4] != 0 || response[12] != 3)
+			errx(2, "unexpected response to request %d", i);
+	}
+	std::sort(latency, latency + requests);
+	return latency;
+}
+
+void print(const char *name, double *latency, int requests)
+{
+	double sum = 0;
+	for(int i = 0; i < requests; ++i) {
+		sum += latency[i];
+	}
+	printf("%8s %10.1f %10.1f %10.1f %10.1f\n", name, sum / requests, latency[requests / 2],
+	  latency[requests * 99 / 100], latency[requests - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc < 3)
+		errx(2, "usage: ./transport_bench <host_name>:<port> <socket_path> [requests]");
+	int requests = argc > 3 ? atoi(argv[3]) : 100000;
+	int tcp = connect_tcp(argv[1]);
+	int local = connect_unix(argv[2]);
+	int shared = connect_unix(argv[2]);
+	Shm_Channel *shm = attach_shm(shared);
+	// warm every path up before measuring
+	free(run(tcp, nullptr, 1000));
+	free(run(local, nullptr, 1000));
+	free(run(shared, shm, 1000));
+	double *tcp_latency = run(tcp, nullptr, requests);
+	double *unix_latency = run(local, nullptr, requests);
+	double *shm_latency = run(shared, shm, requests);
+	printf("%8s %10s %10s %10s %10s\n", "(us)", "mean", "p50", "p99", "max");
+	print("tcp", tcp_latency, requests);
+	print("unix", unix_latency, requests);
+	print("shm", shm_latency, requests);
+	free(tcp_latency);
+	free(unix_latency);
+	free(shm_latency);
+	delete shm;
+	close(tcp);
+	close(local);
+	close(shared);
+	return 0;
+}
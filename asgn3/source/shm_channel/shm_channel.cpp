@@ -0,0 +1,250 @@
+/** Shm_Channel source file
+ *  Shared memory transport for clients on the same host
+ *
+ *  @author Perry David Ralston Jr.
+ *  @date 12/14/2020
+ */
+
+#include "shm_channel.h"
+#include <atomic>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+Shm_Channel::Shm_Channel()
+{
+	in = out = nullptr;
+	segment = MAP_FAILED;
+	fds[0] = fds[1] = fds[2] = -1;
+	own_bell = peer_bell = sock = watch = -1;
+	parked = false;
+}
+
+Shm_Channel::~Shm_Channel()
+{
+	if(segment != MAP_FAILED)
+		munmap(segment, 2 * sizeof(ring));
+	for(int i = 0; i < SHARED_FDS; ++i) {
+		if(fds[i] != -1)
+			close(fds[i]);
+	}
+	if(watch != -1)
+		close(watch);
+}
+
+/**
+ * create
+ * @param sock: unix domain socket of the client
+ * @return: server side of a new channel, nullptr on error. Sets errno appropriately
+ *
+ * The server side also builds an epoll instance holding its doorbell
+ * and the client's socket, so the event loop can watch both through a
+ * single descriptor.
+ **/
+Shm_Channel *Shm_Channel::create(int sock)
+{
+	Shm_Channel *self = new Shm_Channel();
+	self->sock = sock;
+	self->fds[0] = memfd_create("rpcserver-shm", MFD_CLOEXEC);
+	self->fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	self->fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	self->watch = epoll_create1(EPOLL_CLOEXEC);
+	if(self->fds[0] == -1 || self->fds[1] == -1 || self->fds[2] == -1 || self->watch == -1
+		|| ftruncate(self->fds[0], 2 * sizeof(ring)) == -1) {
+		delete self;
+		return nullptr;
+	}
+	self->segment
+	  = mmap(NULL, 2 * sizeof(ring), PROT_READ | PROT_WRITE, MAP_SHARED, self->fds[0], 0);
+	if(self->segment == MAP_FAILED) {
+		delete self;
+		return nullptr;
+	}
+	// a new memfd is zero filled, which is an empty ring
+	self->in = (ring *)self->segment;
+	self->out = self->in + 1;
+	self->own_bell = self->fds[1];
+	self->peer_bell = self->fds[2];
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = self->own_bell;
+	if(epoll_ctl(self->watch, EPOLL_CTL_ADD, self->own_bell, &ev) == -1) {
+		delete self;
+		return nullptr;
+	}
+	// only a hang up, stray bytes on the socket must not wake the server
+	ev.events = EPOLLRDHUP;
+	ev.data.fd = sock;
+	if(epoll_ctl(self->watch, EPOLL_CTL_ADD, sock, &ev) == -1) {
+		delete self;
+		return nullptr;
+	}
+	return self;
+}
+
+/**
+ * attach
+ * @param sock: socket connected to the server
+ * @param shared: the SHARED_FDS descriptors the server sent, owned by the channel afterwards
+ * @return: client side of the channel, nullptr on error. Sets errno appropriately
+ **/
+Shm_Channel *Shm_Channel::attach(int sock, int *shared)
+{
+	Shm_Channel *self = new Shm_Channel();
+	self->sock = sock;
+	memcpy(self->fds, shared, sizeof(self->fds));
+	self->segment
+	  = mmap(NULL, 2 * sizeof(ring), PROT_READ | PROT_WRITE, MAP_SHARED, self->fds[0], 0);
+	if(self->segment == MAP_FAILED) {
+		delete self;
+		return nullptr;
+	}
+	self->out = (ring *)self->segment;
+	self->in = self->out + 1;
+	self->own_bell = self->fds[2];
+	self->peer_bell = self->fds[1];
+	return self;
+}
+
+void Shm_Channel::ring_bell(int bell)
+{
+	uint64_t one = 1;
+	while(::write(bell, &one, sizeof(one)) == -1 && errno == EINTR) {
+	}
+}
+
+void Shm_Channel::drain_bell()
+{
+	uint64_t count;
+	while(::read(own_bell, &count, sizeof(count)) == -1 && errno == EINTR) {
+	}
+}
+
+/**
+ * read
+ * @param dest: where to copy the bytes
+ * @param size: most bytes to copy
+ * @return: number of bytes copied, 0 if the ring is empty
+ *
+ * Rings the peer's doorbell if it is asleep waiting for space.
+ **/
+size_t Shm_Channel::read(uint8_t *dest, size_t size)
+{
+	uint64_t head = in->head.load(std::memory_order_relaxed);
+	uint64_t avail = in->tail.load(std::memory_order_acquire) - head;
+	size = size < avail ? size : avail;
+	if(size == 0)
+		return 0;
+	size_t first = RING_SIZE - (head & (RING_SIZE - 1));
+	first = first < size ? first : size;
+	memcpy(dest, in->data + (head & (RING_SIZE - 1)), first);
+	memcpy(dest + first, in->data, size - first);
+	in->head.store(head + size, std::memory_order_release);
+	// pairs with the fence in wait so a sleeping producer is never missed
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(in->producer_waiting.load(std::memory_order_relaxed) != 0)
+		ring_bell(peer_bell);
+	return size;
+}
+
+/**
+ * write
+ * @param src: bytes to copy into the ring
+ * @param size: number of bytes
+ * @return: number of bytes copied, 0 if the ring is full
+ *
+ * Rings the peer's doorbell if it is asleep waiting for bytes.
+ **/
+size_t Shm_Channel::write(const uint8_t *src, size_t size)
+{
+	uint64_t tail = out->tail.load(std::memory_order_relaxed);
+	uint64_t space = RING_SIZE - (tail - out->head.load(std::memory_order_acquire));
+	size = size < space ? size : space;
+	if(size == 0)
+		return 0;
+	size_t first = RING_SIZE - (tail & (RING_SIZE - 1));
+	first = first < size ? first : size;
+	memcpy(out->data + (tail & (RING_SIZE - 1)), src, first);
+	memcpy(out->data, src + first, size - first);
+	out->tail.store(tail + size, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(out->consumer_waiting.load(std::memory_order_relaxed) != 0)
+		ring_bell(peer_bell);
+	return size;
+}
+
+/**
+ * wait
+ * @param for_space: wait for space in the outgoing ring instead of bytes
+ *        in the incoming one
+ * @return: 0 once the caller should retry, -1 if the peer hung up
+ *
+ * Flags this side as asleep, checks the ring once more and sleeps on
+ * the doorbell and the socket.
+ **/
+int8_t Shm_Channel::wait(bool for_space)
+{
+	std::atomic<uint32_t> &flag = for_space ? out->producer_waiting : in->consumer_waiting;
+	flag.store(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	bool ready = for_space ? out->tail.load(std::memory_order_relaxed)
+							   - out->head.load(std::memory_order_relaxed)
+							 < RING_SIZE
+						   : readable();
+	int8_t res = 0;
+	if(!ready) {
+		struct pollfd pfds[2] = {{own_bell, POLLIN, 0}, {sock, POLLRDHUP, 0}};
+		while(poll(pfds, 2, -1) == -1 && errno == EINTR) {
+		}
+		if((pfds[1].revents & (POLLRDHUP | POLLHUP | POLLERR)) != 0)
+			res = -1;
+		drain_bell();
+	}
+	flag.store(0, std::memory_order_relaxed);
+	return res;
+}
+
+/**
+ * park
+ * Flags the server side as asleep before the connection goes back to
+ * the event loop. If bytes slipped in before the flag was seen, the
+ * server rings its own doorbell so the event loop wakes it at once.
+ **/
+void Shm_Channel::park()
+{
+	in->consumer_waiting.store(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	parked = true;
+	if(readable())
+		ring_bell(own_bell);
+}
+
+/**
+ * unpark
+ * @return: 0 if the client is still there, -1 if it hung up
+ *
+ * Clears the sleep flag and the doorbell after the event loop woke the
+ * connection. Does nothing on a connection that was not parked.
+ **/
+int8_t Shm_Channel::unpark()
+{
+	if(!parked)
+		return 0;
+	parked = false;
+	in->consumer_waiting.store(0, std::memory_order_relaxed);
+	drain_bell();
+	// the socket carries no data once attached, anything but a quiet
+	// socket ends the connection, or the watch keeps reporting it
+	struct pollfd pfd = {sock, POLLRDHUP, 0};
+	int ready;
+	while((ready = poll(&pfd, 1, 0)) == -1 && errno == EINTR)
+		;
+	if(ready == -1 || (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR | POLLNVAL)))
+		return -1;
+	return 0;
+}
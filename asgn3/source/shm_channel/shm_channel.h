@@ -0,0 +1,78 @@
+/** Shm_Channel header file
+ *  Shared memory transport for clients on the same host. A memfd
+ *  segment holds two single-producer/single-consumer byte rings, one
+ *  toward the server and one toward the client, carrying the same
+ *  request and response bytes as the socket. Each side owns an eventfd
+ *  doorbell that the other side only rings when it has flagged that it
+ *  is asleep, so a busy connection needs no syscalls at all.
+ *
+ *  The server creates the channel and passes the segment and both
+ *  doorbells to the client over its unix domain socket. The socket
+ *  stays open and is only watched for the client hanging up.
+ *
+ *  @author Perry David Ralston Jr.
+ *  @date 12/14/2020
+ */
+
+#ifndef SHM_CHANNEL
+#define SHM_CHANNEL
+
+#include <atomic>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "mpmc_queue.h"
+
+class Shm_Channel
+{
+  public:
+	static const size_t RING_SIZE = 1 << 16;
+	// memfd, server doorbell, client doorbell
+	static const int SHARED_FDS = 3;
+
+  private:
+	struct ring {
+		alignas(CACHE_LINE) std::atomic<uint64_t> head;
+		alignas(CACHE_LINE) std::atomic<uint64_t> tail;
+		alignas(CACHE_LINE) std::atomic<uint32_t> consumer_waiting;
+		alignas(CACHE_LINE) std::atomic<uint32_t> producer_waiting;
+		alignas(CACHE_LINE) uint8_t data[RING_SIZE];
+	};
+	ring *in;
+	ring *out;
+	void *segment;
+	int fds[SHARED_FDS];
+	int own_bell;
+	int peer_bell;
+	int sock;
+	int watch;
+	bool parked;
+	Shm_Channel();
+	void ring_bell(int);
+	void drain_bell();
+
+  public:
+	static Shm_Channel *create(int);
+	static Shm_Channel *attach(int, int *);
+	~Shm_Channel();
+	const int *shared_fds()
+	{
+		return fds;
+	}
+	int watch_fd()
+	{
+		return watch;
+	}
+	bool readable()
+	{
+		return in->tail.load(std::memory_order_acquire) != in->head.load(std::memory_order_relaxed);
+	}
+	size_t read(uint8_t *, size_t);
+	size_t write(const uint8_t *, size_t);
+	int8_t wait(bool);
+	void park();
+	int8_t unpark();
+};
+
+#endif
@@ -0,0 +1,256 @@
+/**
+ * Swiss_Table source file
+ * Open addressing table of inline key/value slots
+ *
+ * @author Perry David Ralston Jr.
+ * @date 12/15/2020
+ */
+
+#include "swiss_table.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * match
+ * @param group: GROUP_SIZE control bytes
+ * @param value: control byte to look for
+ * @return: bit i set if control byte i equals value
+ **/
+static inline uint32_t match(const int8_t *group, int8_t value)
+{
+#ifdef __SSE2__
+	__m128i ctrl = _mm_load_si128((const __m128i *)group);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value)));
+#else
+	uint32_t mask = 0;
+	for(size_t i = 0; i < Swiss_Table::GROUP_SIZE; ++i) {
+		mask |= (uint32_t)(group[i] == value) << i;
+	}
+	return mask;
+#endif
+}
+
+/**
+ * match_free
+ * @return: bit i set if slot i of the group is empty or deleted, both
+ *          have the high bit set
+ **/
+static inline uint32_t match_free(const int8_t *group)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+#else
+	uint32_t mask = 0;
+	for(size_t i = 0; i < Swiss_Table::GROUP_SIZE; ++i) {
+		mask |= (uint32_t)(group[i] < 0) << i;
+	}
+	return mask;
+#endif
+}
+
+template<class Value>
+Basic_Swiss_Table<Value>::Basic_Swiss_Table()
+{
+	ctrl = nullptr;
+	slots = nullptr;
+	capacity = count = tombstones = 0;
+	rehash(GROUP_SIZE);
+}
+
+template<class Value>
+Basic_Swiss_Table<Value>::~Basic_Swiss_Table()
+{
+	free(ctrl);
+	free(slots);
+}
+
+/**
+ * hash
+ * FNV-1a over the key, the low bits pick the first group and the top 7
+ * bits go in the control byte
+ **/
+template<class Value>
+uint64_t Basic_Swiss_Table<Value>::hash(const uint8_t *key)
+{
+	uint64_t value = 0xcbf29ce484222325ull;
+	for(size_t i = 0; i < Record::KEY_SIZE && key[i] != '\0'; ++i) {
+		value = (value ^ key[i]) * 0x100000001b3ull;
+	}
+	return value;
+}
+
+/**
+ * probe
+ * @param key: zero padded to Record::KEY_SIZE
+ * @param value: hash of the key
+ * @return: index of the key's slot, capacity if it is not in the table
+ *
+ * Visits the groups in triangular order, which reaches every group of
+ * a power of two table. An empty slot in a group ends the search.
+ **/
+template<class Value>
+size_t Basic_Swiss_Table<Value>::probe(const uint8_t *key, uint64_t value)
+{
+	size_t groups = capacity / GROUP_SIZE;
+	size_t group = value & (groups - 1);
+	int8_t tag = value >> 57;
+	for(size_t step = 1; step <= groups; ++step) {
+		const int8_t *curr = ctrl + group * GROUP_SIZE;
+		for(uint32_t mask = match(curr, tag); mask != 0; mask &= mask - 1) {
+			size_t index = group * GROUP_SIZE + __builtin_ctz(mask);
+			if(memcmp(slots[index].key, key, Record::KEY_SIZE) == 0)
+				return index;
+		}
+		if(match(curr, EMPTY) != 0)
+			break;
+		group = (group + step) & (groups - 1);
+	}
+	return capacity;
+}
+
+/**
+ * free_slot
+ * @return: index of the first empty or deleted slot on the probe path
+ **/
+template<class Value>
+size_t Basic_Swiss_Table<Value>::free_slot(uint64_t value)
+{
+	size_t groups = capacity / GROUP_SIZE;
+	size_t group = value & (groups - 1);
+	for(size_t step = 1;; ++step) {
+		uint32_t mask = match_free(ctrl + group * GROUP_SIZE);
+		if(mask != 0)
+			return group * GROUP_SIZE + __builtin_ctz(mask);
+		group = (group + step) & (groups - 1);
+	}
+}
+
+/**
+ * rehash
+ * @param new_capacity: number of slots, a power of two multiple of GROUP_SIZE
+ *
+ * Moves every live slot into fresh arrays, which also drops the
+ * tombstones left by erase
+ **/
+template<class Value>
+void Basic_Swiss_Table<Value>::rehash(size_t new_capacity)
+{
+	int8_t *old_ctrl = ctrl;
+	Record *old_slots = slots;
+	size_t old_capacity = capacity;
+	// SSE2 loads want the control groups 16 byte aligned
+	ctrl = (int8_t *)aligned_alloc(GROUP_SIZE, new_capacity);
+	slots = (Record *)malloc(new_capacity * sizeof(Record));
+	if(ctrl == nullptr || slots == nullptr)
+		err(EXIT_FAILURE, "swiss table");
+	memset(ctrl, EMPTY, new_capacity);
+	capacity = new_capacity;
+	tombstones = 0;
+	for(size_t i = 0; i < old_capacity; ++i) {
+		if(old_ctrl[i] < 0)
+			continue;
+		uint64_t value = hash(old_slots[i].key);
+		size_t index = free_slot(value);
+		ctrl[index] = value >> 57;
+		slots[index] = old_slots[i];
+	}
+	free(old_ctrl);
+	free(old_slots);
+}
+
+/**
+ * find
+ * @param key: null terminated key, shorter than Record::KEY_SIZE
+ * @return: the key's slot, nullptr if it is not in the table
+ **/
+template<class Value>
+typename Basic_Swiss_Table<Value>::Record *Basic_Swiss_Table<Value>::find(const uint8_t *key)
+{
+	uint8_t padded[Record::KEY_SIZE] = {0};
+	strncpy((char *)padded, (const char *)key, Record::KEY_SIZE - 1);
+	size_t index = probe(padded, hash(padded));
+	return index == capacity ? nullptr : &slots[index];
+}
+
+/**
+ * insert
+ * @param key: null terminated key, shorter than Record::KEY_SIZE
+ * @return: the key's slot, a new one holding only the key if the key
+ *          was not in the table
+ *
+ * Grows the table once live and deleted slots pass 7/8 of it. A table
+ * that is mostly tombstones is rebuilt at the same size instead.
+ **/
+template<class Value>
+typename Basic_Swiss_Table<Value>::Record *Basic_Swiss_Table<Value>::insert(const uint8_t *key)
+{
+	uint8_t padded[Record::KEY_SIZE] = {0};
+	strncpy((char *)padded, (const char *)key, Record::KEY_SIZE - 1);
+	uint64_t value = hash(padded);
+	size_t index = probe(padded, value);
+	if(index != capacity)
+		return &slots[index];
+	if((count + tombstones + 1) * 8 > capacity * 7) {
+		rehash(count * 2 >= capacity ? capacity * 2 : capacity);
+	}
+	index = free_slot(value);
+	if(ctrl[index] == DELETED)
+		--tombstones;
+	ctrl[index] = value >> 57;
+	memcpy(slots[index].key, padded, Record::KEY_SIZE);
+	++count;
+	return &slots[index];
+}
+
+/**
+ * erase
+ * @param key: null terminated key
+ * @return: 0 on success, -1 if the key is not in the table
+ *
+ * Leaves a tombstone so probes for keys placed further along still
+ * pass over the slot
+ **/
+template<class Value>
+int8_t Basic_Swiss_Table<Value>::erase(const uint8_t *key)
+{
+	uint8_t padded[Record::KEY_SIZE] = {0};
+	strncpy((char *)padded, (const char *)key, Record::KEY_SIZE - 1);
+	size_t index = probe(padded, hash(padded));
+	if(index == capacity)
+		return -1;
+	ctrl[index] = DELETED;
+	--count;
+	++tombstones;
+	return 0;
+}
+
+/**
+ * next
+ * @param pos: slot to start at, 0 for the first call, advanced past the
+ *        returned slot
+ * @return: the next live slot, nullptr after the last one
+ **/
+template<class Value>
+typename Basic_Swiss_Table<Value>::Record *Basic_Swiss_Table<Value>::next(size_t &pos)
+{
+	while(pos < capacity) {
+		if(ctrl[pos++] >= 0)
+			return &slots[pos - 1];
+	}
+	return nullptr;
+}
+
+template<class Value>
+void Basic_Swiss_Table<Value>::clear()
+{
+	memset(ctrl, EMPTY, capacity);
+	count = tombstones = 0;
+}
+
+template class Basic_Swiss_Table<Variant>;
+template class Basic_Swiss_Table<int64_t>;
@@ -0,0 +1,79 @@
+/**
+ * Swiss_Table header file
+ * Open addressing table of inline key/value slots. A control byte per
+ * slot holds 7 bits of the key's hash, or marks the slot empty or
+ * deleted, and a probe compares 16 control bytes at once with SSE2, so
+ * most lookups touch one control group and one slot.
+ *
+ * @author Perry David Ralston Jr.
+ * @date 12/15/2020
+ */
+#ifndef SWISS_TABLE
+#define SWISS_TABLE
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/**
+ * Variant
+ * Value of a record that holds either a number or the name of another
+ * variable, told apart by isNum
+ **/
+struct Variant {
+	static const size_t NAME_SIZE = 32;
+	union data {
+		int64_t num_val;
+		uint8_t var_val[NAME_SIZE];
+	} data;
+	bool isNum;
+};
+
+/**
+ * Basic_Slot
+ * @param Value: Variant, or int64_t for tables that only hold numbers
+ **/
+template<class Value>
+struct Basic_Slot {
+	static const size_t KEY_SIZE = Variant::NAME_SIZE;
+	uint8_t key[KEY_SIZE];
+	Value value;
+};
+
+typedef Basic_Slot<Variant> Slot;
+
+template<class Value>
+class Basic_Swiss_Table
+{
+  public:
+	typedef Basic_Slot<Value> Record;
+	static const size_t GROUP_SIZE = 16;
+	Basic_Swiss_Table();
+	~Basic_Swiss_Table();
+	Record *find(const uint8_t *);
+	Record *insert(const uint8_t *);
+	int8_t erase(const uint8_t *);
+	Record *next(size_t &);
+	void clear();
+	size_t size()
+	{
+		return count;
+	}
+
+  private:
+	static const int8_t EMPTY = -128;
+	static const int8_t DELETED = -2;
+	int8_t *ctrl;
+	Record *slots;
+	size_t capacity;
+	size_t count;
+	size_t tombstones;
+	static uint64_t hash(const uint8_t *);
+	size_t probe(const uint8_t *, uint64_t);
+	size_t free_slot(uint64_t);
+	void rehash(size_t);
+};
+
+typedef Basic_Swiss_Table<Variant> Swiss_Table;
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ * SyncHash read contention benchmark
+ *
+ * Runs 1 to 64 threads that look up a handful of hot variables, with
+ * one insert every INSERT_EVERY operations, and reports operations per
+ * second. Each thread count runs twice: once with plain lookups, which
+ * read the bucket optimistically and fall back to sharing its lock, and
+ * once with every lookup wrapped in an exclusive acquire of its key as
+ * all lookups used to be.
+ *
+ * usage: ./contention_bench [ops_per_thread] [hot_keys] [buckets]
+ *
+ * @author Perry David Ralston Jr
+ * @date 12/18/2020
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sync_hash.h"
+
+static const int MAX_THREADS = 64;
+// one insert for every INSERT_EVERY operations
+static const int INSERT_EVERY = 100;
+
+struct worker {
+	SyncHash *table;
+	int64_t ident;
+	int64_t ops;
+	int hot_keys;
+	bool exclusive;
+};
+
+void *run(void *arg)
+{
+	worker *self = (worker *)arg;
+	uint8_t key[SyncHash::DEFAULT_SIZE];
+	int64_t value;
+	uint32_t seed = self->ident * 2654435761u + 1;
+	for(int64_t i = 0; i < self->ops; ++i) {
+		seed = seed * 1103515245 + 12345;
+		snprintf((char *)key, sizeof(key), "hot%u", (seed >> 8) % self->hot_keys);
+		if(i % INSERT_EVERY == 0) {
+			self->table->insert<int64_t>(key, i, self->ident);
+		} else if(self->exclusive) {
+			self->table->acquire(key, self->ident);
+			self->table->lookup(key, value, self->ident);
+			self->table->release(key, self->ident);
+		} else {
+			self->table->lookup(key, value, self->ident);
+		}
+	}
+	return NULL;
+}
+
+double bench(SyncHash *table, int num_threads, int64_t ops, int hot_keys, bool exclusive)
+{
+	worker *workers = (worker *)calloc(num_threads, sizeof(worker));
+	pthread_t *tids = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+	double begin = now();
+	for(int i = 0; i < num_threads; ++i) {
+		workers[i] = {table, i, ops, hot_keys, exclusive};
+		pthread_create(&tids[i], NULL, run, &workers[i]);
+	}
+	for(int i = 0; i < num_threads; ++i) {
+		pthread_join(tids[i], NULL);
+	}
+	double elapsed = now() - begin;
+	free(workers);
+	free(tids);
+	return num_threads * ops / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	int64_t ops = argc > 1 ? atol(argv[1]) : 200000;
+	int hot_keys = argc > 2 ? atoi(argv[2]) : 4;
+	size_t buckets = argc > 3 ? atol(argv[3]) : SyncHash::DEFAULT_SIZE;
+	if(hot_keys <= 0)
+		errx(2, "hot_keys must be positive");
+	Log_Dir log_dir("contention_bench");
+	SyncHash *table = new SyncHash(buckets, Hash::DEFAULT_RECUR, log_dir.path);
+	printf("%d hot keys, %zu buckets, 1 insert per %d ops\n", hot_keys, buckets, INSERT_EVERY);
+	printf("%8s %20s %20s\n", "threads", "lookup (ops/s)", "exclusive (ops/s)");
+	for(int n = 1; n <= MAX_THREADS; n *= 2) {
+		double plain = bench(table, n, ops, hot_keys, false);
+		double exclusive = bench(table, n, ops, hot_keys, true);
+		printf("%8d %20.0f %20.0f\n", n, plain, exclusive);
+	}
+	return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * SyncHash mixed workload benchmark
+ *
+ * Runs 1 to 64 threads of random lookups, inserts and removes over a
+ * shared key space and reports operations per second, once on the
+ * locked buckets and once on the lock-free table. Both write the log
+ * on every insert and remove, so a high write share mostly measures it.
+ *
+ * usage: ./mixed_bench [ops_per_thread] [keys] [lookup_percent] [buckets]
+ *
+ * Inserts and removes split the operations that are not lookups evenly.
+ *
+ * @author Perry David Ralston Jr
+ * @date 12/19/2020
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sync_hash.h"
+
+static const int MAX_THREADS = 64;
+
+struct worker {
+	SyncHash *table;
+	int64_t ident;
+	int64_t ops;
+	int keys;
+	int lookup_percent;
+};
+
+void *run(void *arg)
+{
+	worker *self = (worker *)arg;
+	uint8_t key[SyncHash::DEFAULT_SIZE];
+	int64_t value;
+	uint32_t seed = self->ident * 2654435761u + 1;
+	for(int64_t i = 0; i < self->ops; ++i) {
+		seed = seed * 1103515245 + 12345;
+		snprintf((char *)key, sizeof(key), "key%u", (seed >> 8) % self->keys);
+		int roll = (seed >> 4) % 100;
+		if(roll < self->lookup_percent) {
+			self->table->lookup(key, value, self->ident);
+		} else if((roll - self->lookup_percent) % 2 == 0) {
+			self->table->insert<int64_t>(key, i, self->ident);
+		} else {
+			self->table->remove(key, self->ident);
+		}
+	}
+	return NULL;
+}
+
+double bench(SyncHash *table, int num_threads, int64_t ops, int keys, int lookup_percent)
+{
+	worker *workers = (worker *)calloc(num_threads, sizeof(worker));
+	pthread_t *tids = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+	double begin = now();
+	for(int i = 0; i < num_threads; ++i) {
+		workers[i] = {table, i, ops, keys, lookup_percent};
+		pthread_create(&tids[i], NULL, run, &workers[i]);
+	}
+	for(int i = 0; i < num_threads; ++i) {
+		pthread_join(tids[i], NULL);
+	}
+	double elapsed = now() - begin;
+	free(workers);
+	free(tids);
+	return num_threads * ops / elapsed;
+}
+
+/**
+ * fill
+ * Inserts every other key, so inserts and removes both find work
+ **/
+void fill(SyncHash *table, int keys)
+{
+	uint8_t key[SyncHash::DEFAULT_SIZE];
+	for(int i = 0; i < keys; i += 2) {
+		snprintf((char *)key, sizeof(key), "key%d", i);
+		table->insert<int64_t>(key, i, 0);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int64_t ops = argc > 1 ? atol(argv[1]) : 100000;
+	int keys = argc > 2 ? atoi(argv[2]) : 1024;
+	int lookup_percent = argc > 3 ? atoi(argv[3]) : 90;
+	size_t buckets = argc > 4 ? atol(argv[4]) : SyncHash::DEFAULT_SIZE;
+	if(keys <= 0)
+		errx(2, "keys must be positive");
+	if(lookup_percent < 0 || lookup_percent > 100)
+		errx(2, "lookup_percent must be between 0 and 100");
+	Log_Dir locked_dir("mixed_bench"), lock_free_dir("mixed_bench");
+	SyncHash *locked = new SyncHash(buckets, Hash::DEFAULT_RECUR, locked_dir.path);
+	fill(locked, keys);
+	printf("%d keys, %zu buckets, %d%% lookups\n", keys, buckets, lookup_percent);
+	printf("%8s %20s %20s\n", "threads", "locked (ops/s)", "lock-free (ops/s)");
+	double locked_rate[MAX_THREADS + 1];
+	for(int n = 1; n <= MAX_THREADS; n *= 2) {
+		locked_rate[n] = bench(locked, n, ops, keys, lookup_percent);
+	}
+	delete locked;
+	SyncHash *lock_free = new SyncHash(buckets, Hash::DEFAULT_RECUR, lock_free_dir.path, Hash::CHAINED, true);
+	fill(lock_free, keys);
+	for(int n = 1; n <= MAX_THREADS; n *= 2) {
+		double rate = bench(lock_free, n, ops, keys, lookup_percent);
+		printf("%8d %20.0f %20.0f\n", n, locked_rate[n], rate);
+	}
+	delete lock_free;
+	return 0;
+}
@@ -7,21 +7,71 @@
 #include <algorithm>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
+#include "placement.h"
 #include "sync_hash.h"
 
-SyncHash::SyncHash(size_t size, uint16_t recur, char* _logdir) : Hash(size, recur, _logdir) {
-	locks = (bucket_lock*)calloc(tblSize, sizeof(bucket_lock));
+/**
+ * SyncHash
+ * @param lock_free: keep the records in an LF_Table instead of the
+ *        locked buckets, backend is then only used to replay the log
+ **/
+SyncHash::SyncHash(size_t size, uint16_t recur, char* _logdir, Backend backend, bool lock_free)
+  : Hash(size, recur, _logdir, backend) {
+	locks = (bucket_lock*)aligned_alloc(alignof(bucket_lock), tblSize * sizeof(bucket_lock));
+	if (locks == nullptr) err(2,"synch_hash.locks[]");
+	// waiting writers hold off new readers, so inserts on a hot bucket
+	// are not starved by its lookups
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
 	for (size_t i = 0; i < tblSize; ++i) {
-		bucket_lock current = locks[i];
+		bucket_lock &current = locks[i];
 		current.count = 0;
-		current.owner = NO_PARENT;
-		if (0 != sem_init(&current.mutex, 0, 0)) err(2,"sem_init synch_hash.locks[]");
+		current.owner.store(NO_PARENT, std::memory_order_relaxed);
+		current.seq.store(0, std::memory_order_relaxed);
+		if (0 != pthread_rwlock_init(&current.rwlock, &attr)) err(2,"pthread_rwlock_init synch_hash.locks[]");
+	}
+	pthread_rwlockattr_destroy(&attr);
+	lockfree = nullptr;
+	if (lock_free) {
+		// the log was replayed into the buckets, move the records over
+		lockfree = new LF_Table(tblSize);
+		visit([this](const uint8_t* key, const Variant& value) {
+			return lockfree->insert(key, value, 0);
+		});
+		reset();
+	}
+}
+
+SyncHash::~SyncHash()
+{
+	delete lockfree;
+	for (size_t i = 0; i < tblSize; ++i) {
+		pthread_rwlock_destroy(&locks[i].rwlock);
+	}
+	free(locks);
+}
+
+/**
+ * interleave_memory
+ * Spreads the stripes and their locks over every NUMA node. Every
+ * worker touches them, so no single node should own them all. Chains
+ * and Nodes stay on the node of the worker that allocated them.
+ **/
+void SyncHash::interleave_memory()
+{
+	if (interleave(hTable, tblSize * sizeof(*hTable)) == -1
+		|| interleave(locks, tblSize * sizeof(bucket_lock)) == -1) {
+		warn("interleave: %s", strerror(errno));
 	}
 }
 
@@ -35,16 +85,20 @@ SyncHash::SyncHash(size_t size, uint16_t recur, char* _logdir) : Hash(size, recu
  **/
 int8_t SyncHash::remove(uint8_t *key, int64_t ident)
 {
-	int32_t hash = genHash(key);
+	uint64_t hashed;
+	int32_t hash = genHash(key, &hashed);
 	if (hash == -1) {
 		return -1;
 	}
+	// a lock-free table is still written under the bucket lock, so the
+	// log records its writes in the order it applied them
 	acquire(hash, ident);
-	if (Hash::remove(key) == -1) {
-		return -1;
+	int8_t ret_val = lockfree != nullptr ? lockfree->remove(key, ident) : Hash::remove(hash, hashed, key);
+	if (ret_val == 0) {
+		log_remove(key);
 	}
-	release(hash);
-	return 0;
+	release(hash, ident);
+	return ret_val;
 }
 
 /**
@@ -57,38 +111,115 @@ int8_t SyncHash::remove(uint8_t *key, int64_t ident)
  * Hashes the key and uses the hash value to find
  * the corresponding node in the table. If the node is found
  * value is set to the value of the node and 0 is returned. -1 is returned
- * otherwise.
+ * otherwise. Lookups share the bucket lock with each other.
+ *
+ * A numeric lookup first reads the bucket without the lock, and keeps
+ * the result if no writer held the bucket meanwhile, so uncontended
+ * lookups write no shared memory at all.
  **/
 int8_t SyncHash::lookup(uint8_t *key, int64_t &value, int64_t ident)
 {
-	int32_t hash = genHash(key);
+	if (lockfree != nullptr) {
+		Variant record;
+		if (validate_key((char*)key) != 0 || lockfree->lookup(key, record, ident) == -1) {
+			return -1;
+		}
+		if (!record.isNum) {
+			errno = EFAULT;
+			return -1;
+		}
+		value = record.data.num_val;
+		return 0;
+	}
+	uint64_t hashed;
+	int32_t hash = genHash(key, &hashed);
 	if (hash == -1) {
 		errno = EINVAL;
 		return -1;
 	}
-	acquire(hash, ident);
-	int8_t ret_val = Hash::lookup(key, value);
-	release(hash);
+	bucket_lock &lock = locks[hash];
+	for (int i = 0; i < OPTIMISTIC_TRIES && ident != lock.owner.load(std::memory_order_relaxed); ++i) {
+		uint64_t seq = lock.seq.load(std::memory_order_acquire);
+		if (seq & 1) {
+			break;
+		}
+		int64_t peeked;
+		int found = peek(hash, hashed, key, peeked);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (seq != lock.seq.load(std::memory_order_relaxed)) {
+			continue;
+		}
+		if (found == -1) {
+			break;
+		}
+		if (found != 0) {
+			errno = found;
+			return -1;
+		}
+		value = peeked;
+		return 0;
+	}
+	acquire(hash, ident, true);
+	int8_t ret_val = Hash::lookup(hash, hashed, key, value);
+	release(hash, ident);
 	return ret_val;
 }
 
 int8_t SyncHash::lookup(uint8_t *key, uint8_t*& value, int64_t ident)
 {
-	int32_t hash = genHash(key);
+	if (lockfree != nullptr) {
+		Variant record;
+		if (validate_key((char*)key) != 0 || lockfree->lookup(key, record, ident) == -1) {
+			return -1;
+		}
+		if (record.isNum) {
+			errno = EFAULT;
+			return -1;
+		}
+		strcpy((char*)value, (char*)record.data.var_val);
+		return 0;
+	}
+	uint64_t hashed;
+	int32_t hash = genHash(key, &hashed);
 	if (hash == -1) {
 		errno = EINVAL;
 		return -1;
 	}
-	acquire(hash, ident);
-	int8_t ret_val = Hash::lookup(key, value);
-	release(hash);
+	acquire(hash, ident, true);
+	int8_t ret_val = Hash::lookup(hash, hashed, key, value);
+	release(hash, ident);
 	return ret_val;
 }
 
+/**
+ * rlookup
+ * @details Locks every bucket shared, so the chain of names is followed
+ * in one snapshot. The lock-free table follows it one lookup at a time,
+ * so a chain changed meanwhile may be seen partly old and partly new.
+ **/
 int8_t SyncHash::rlookup(uint8_t *key, int64_t &value, int64_t ident) {
-	acquire_all(ident);
+	if (lockfree != nullptr) {
+		Variant record;
+		if (validate_key((char*)key) != 0) {
+			errno = ENOENT;
+			return -1;
+		}
+		for (uint16_t recur = get_recur_amt(); recur > 0; --recur) {
+			if (lockfree->lookup(key, record, ident) == -1) {
+				return -1;
+			}
+			if (record.isNum) {
+				value = record.data.num_val;
+				return 0;
+			}
+			key = record.data.var_val;
+		}
+		errno = ELOOP;
+		return -1;
+	}
+	acquire_all(ident, true);
 	int8_t ret_val = Hash::rlookup(key, value, get_recur_amt());
-	release_all();
+	release_all(ident);
 	return ret_val;
 }
 
@@ -100,8 +231,13 @@ int8_t SyncHash::rlookup(uint8_t *key, int64_t &value, int64_t ident) {
 void SyncHash::clear(int64_t ident)
 {
 	acquire_all(ident);
-	Hash::clear();
-	release_all();
+	if (lockfree != nullptr) {
+		lockfree->clear(ident);
+		truncate_log();
+	} else {
+		Hash::clear();
+	}
+	release_all(ident);
 }
 
 /**
@@ -116,9 +252,18 @@ void SyncHash::clear(int64_t ident)
  **/
 int8_t SyncHash::dump(const char *filename, int64_t ident)
 {
-	acquire_all(ident);	
+	if (lockfree != nullptr) {
+		int fd = open(filename, O_WRONLY|O_CREAT|O_EXCL, S_IRWXU);
+		if (fd == -1) {
+			return -1;
+		}
+		int8_t ret_val = lockfree->dump(fd, ident);
+		close(fd);
+		return ret_val;
+	}
+	acquire_all(ident, true);
 	int8_t ret_val = Hash::dump(filename);
-	release_all();
+	release_all(ident);
 	return ret_val;
 }
 
@@ -133,9 +278,17 @@ int8_t SyncHash::dump(const char *filename, int64_t ident)
  **/
 int8_t SyncHash::load(const char *filename, int64_t ident)
 {
-	acquire_all(ident);	
+	if (lockfree != nullptr) {
+		FILE* fp = fopen(filename, "r");
+		if (fp == nullptr) {
+			return -1;
+		}
+		return read_records(fp, [&](uint8_t* key, auto value) { return insert(key, value, ident); },
+		  [&](uint8_t* key) { remove(key, ident); });
+	}
+	acquire_all(ident);
 	int8_t ret_val = Hash::load(filename);
-	release_all();
+	release_all(ident);
 	return ret_val;
 }
 
@@ -143,8 +296,10 @@ int8_t SyncHash::load(const char *filename, int64_t ident)
  * acquire
  * @param key: Key to acquire lock on
  * @param ident: Thread identifier
- * @details Attempt to acquire the lock of the list associated with
- * the key. Checks if the lock is already claimed by this thread  
+ * @details Attempt to acquire the exclusive lock of the list associated
+ * with the key. Checks if the lock is already claimed by this thread.
+ * The lock-free table's writers take the same locks, so a math op on
+ * it stays atomic against them.
  **/
 int8_t SyncHash::acquire(uint8_t * key, int64_t ident) {
 	int32_t hash = genHash(key);
@@ -160,8 +315,8 @@ int8_t SyncHash::acquire(uint8_t * key, int64_t ident) {
  * @param keylist: Keys to acquire lock on
  * @param size: number of keys to acquire
  * @param ident: Thread identifier
- * @details Attempt to acquire the locks of the lists associated with
- * the keys in index order. Checks if the lock is already claimed by this thread  
+ * @details Attempt to acquire the exclusive locks of the lists associated
+ * with the keys in index order. Checks if the lock is already claimed by this thread  
  **/
 int8_t SyncHash::acquire(uint8_t** keylist, size_t size, int64_t ident) {
 	int32_t* hashlist = (int32_t*)calloc(size, sizeof(int32_t));
@@ -172,6 +327,7 @@ int8_t SyncHash::acquire(uint8_t** keylist, size_t size, int64_t ident) {
 	}
 	std::sort(hashlist, hashlist + size);
 	if (hashlist[0] == -1) {
+		free(hashlist);
 		return -1;
 	} 
 	for (size_t i = 0; i < size; ++i) {
@@ -181,20 +337,36 @@ int8_t SyncHash::acquire(uint8_t** keylist, size_t size, int64_t ident) {
 	return 0;	 
 }
 
-void SyncHash::acquire(uint32_t hash, int64_t ident) {
+/**
+ * acquire
+ * @param shared: take the lock shared with other readers
+ * @details The exclusive owner only counts the nesting. Only the owner
+ * ever finds its own ident in owner, so the unlocked read is safe.
+ **/
+void SyncHash::acquire(uint32_t hash, int64_t ident, bool shared) {
 	if (tblSize <= hash) {//this is just a sanity check, not possible to be true
 		return;
 	}
-	if (ident != locks[hash].owner) {
-		if (0 != sem_wait(&locks[hash].mutex)) err(2,"sem_wait in sync_hash");
-		locks[hash].owner = ident;
+	bucket_lock &lock = locks[hash];
+	if (ident == lock.owner.load(std::memory_order_relaxed)) {
+		++lock.count;
+		return;
+	}
+	if (shared) {
+		if (0 != pthread_rwlock_rdlock(&lock.rwlock)) err(2,"pthread_rwlock_rdlock in sync_hash");
+		return;
 	}
-	++locks[hash].count;
+	if (0 != pthread_rwlock_wrlock(&lock.rwlock)) err(2,"pthread_rwlock_wrlock in sync_hash");
+	lock.owner.store(ident, std::memory_order_relaxed);
+	lock.count = 1;
+	// odd until released, the fence keeps the bucket's writes behind it
+	lock.seq.store(lock.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
 }
 
-void SyncHash::acquire_all(int64_t ident) {
+void SyncHash::acquire_all(int64_t ident, bool shared) {
 	for(size_t i = 0; i < tblSize; ++i) {
-		acquire(i, ident);
+		acquire(i, ident, shared);
 	}
 }
 
@@ -203,7 +375,7 @@ void SyncHash::acquire_all(int64_t ident) {
  * @param key: Key to release lock on
  * @param ident: Thread identifier
  * reset the ownership of the lock to NO_PARENT
- * and signal on the mutex if this thread owns the lock
+ * and unlock it if this thread owns the lock
  * @return: 0 if load is successful, -1 otherwise. Sets errno appropriately
  **/
 int8_t SyncHash::release(uint8_t* key, int64_t ident) {
@@ -211,11 +383,11 @@ int8_t SyncHash::release(uint8_t* key, int64_t ident) {
 	if (hash == -1) {
 		return -1;
 	}
-	if (locks[hash].owner != ident) {
+	if (locks[hash].owner.load(std::memory_order_relaxed) != ident) {
 		errno = EINVAL;
 		return -1;
 	}
-	release(hash);
+	release(hash, ident);
 	return 0;
 }
 
@@ -225,7 +397,7 @@ int8_t SyncHash::release(uint8_t* key, int64_t ident) {
  * @param size: number of keys to release locks on
  * @param ident: Thread identifier
  * resets the ownership of each lock to NO_PARENT
- * and signal on the mutex if the lock exists and this thread owns the lock
+ * and unlocks it if the lock exists and this thread owns the lock
  **/
 void SyncHash::release(uint8_t** keylist, size_t size, int64_t ident){
 	int32_t* hashlist = (int32_t*)calloc(size, sizeof(int32_t));
@@ -235,24 +407,51 @@ void SyncHash::release(uint8_t** keylist, size_t size, int64_t ident){
 		}
 	}
 	for (size_t i = 0; i < size; ++i) {
-		if (hashlist[i] != -1 && locks[hashlist[i]].owner == ident) {
-			release(hashlist[i]);
+		if (hashlist[i] != -1 && locks[hashlist[i]].owner.load(std::memory_order_relaxed) == ident) {
+			release(hashlist[i], ident);
 		}
 	}
+	free(hashlist);
 }
 
-void SyncHash::release(uint32_t hash) {
-	if (locks[hash].count > 0) { 
-		--locks[hash].count;
-		if (locks[hash].count == 0) {
-			if (0 != sem_post(&locks[hash].mutex)) err(2,"sem_post in sync_hash");
-			locks[hash].owner = NO_PARENT;
+/**
+ * release
+ * @details Undoes one acquire of the bucket by ident. The owner gives up
+ * the lock after its last nested release, clearing owner before the
+ * unlock so the next owner never sees it reset. Anyone else held it shared.
+ **/
+void SyncHash::release(uint32_t hash, int64_t ident) {
+	bucket_lock &lock = locks[hash];
+	if (ident == lock.owner.load(std::memory_order_relaxed)) {
+		if (--lock.count > 0) {
+			return;
 		}
+		lock.owner.store(NO_PARENT, std::memory_order_relaxed);
+		lock.seq.store(lock.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
 	}
+	if (0 != pthread_rwlock_unlock(&lock.rwlock)) err(2,"pthread_rwlock_unlock in sync_hash");
 }
 
-void SyncHash::release_all() {
+void SyncHash::release_all(int64_t ident) {
 	for(size_t i = 0; i < tblSize; ++i) {
-		release(i);
+		release(i, ident);
 	}
 }
+
+/**
+ * insert_record
+ * @param hash: the key's bucket, whose lock orders the writers of the key
+ * @return: 0, the key and value were checked by insert
+ *
+ * Logs the record once it is in the lock-free table. The bucket lock is
+ * held across both, so the log keeps the table's order of the writes.
+ **/
+int8_t SyncHash::insert_record(int32_t hash, uint8_t* key, const Variant& value, int64_t ident)
+{
+	acquire(hash, ident);
+	lockfree->insert(key, value, ident);
+	write_record(-1, key, value);
+	sync_log();
+	release(hash, ident);
+	return 0;
+}
@@ -6,20 +6,34 @@
 #ifndef SYNCH_HASHH
 #define SYNCH_HASHH
 
+#include <atomic>
 #include <inttypes.h>
-#include <semaphore.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 
 #include "hash.h" 
+#include "lf_table.h"
 
 static const int8_t NO_PARENT = -1;
 
-struct bucket_lock {
-	sem_t mutex;
+/**
+ * bucket_lock
+ * Shared/exclusive lock of one bucket. Lookups share it, writers hold
+ * it alone. The exclusive owner's ident and nesting count make it
+ * reentrant for that owner, who also passes through shared acquires.
+ * Readers are not tracked, so a reader must not lock a bucket twice.
+ * seq is odd while the bucket is held exclusively, so numeric lookups
+ * can read the bucket without locking it and only keep the result if
+ * seq did not move. Each lock has its own cache line so readers of
+ * neighbouring buckets do not contend.
+ **/
+struct alignas(64) bucket_lock {
+	pthread_rwlock_t rwlock;
 	int64_t count;
-	int64_t owner;
+	std::atomic<int64_t> owner;
+	std::atomic<uint64_t> seq;
 };
 
 typedef struct bucket_lock bucket_lock;
@@ -27,8 +41,12 @@ typedef struct bucket_lock bucket_lock;
 class SyncHash : private Hash {
 	public:
 	static const size_t DEFAULT_SIZE = Hash::DEFAULT_SIZE;
+	// optimistic reads of a bucket before a lookup takes its lock
+	static const int OPTIMISTIC_TRIES = 4;
 	SyncHash(): SyncHash(Hash::DEFAULT_SIZE) {}
-	SyncHash(size_t size, uint16_t recur = DEFAULT_RECUR, char* _logdir = DEFAULT_LOG_DIR);
+	SyncHash(size_t size, uint16_t recur = DEFAULT_RECUR, char* _logdir = DEFAULT_LOG_DIR,
+	  Backend backend = CHAINED, bool lock_free = false);
+	~SyncHash();
 	template<class dataType>
 	int8_t insert(uint8_t*, dataType, int64_t);
 	int8_t remove(uint8_t*, int64_t);
@@ -43,12 +61,16 @@ class SyncHash : private Hash {
 	int8_t release(uint8_t*, int64_t);
 	void release(uint8_t**, size_t, int64_t);
 	size_t size() { return tblSize; }
+	void interleave_memory();
 	private:
-	void acquire(uint32_t, int64_t);
-	void acquire_all(int64_t);
-	void release(uint32_t);
-	void release_all();
+	void acquire(uint32_t, int64_t, bool shared = false);
+	void acquire_all(int64_t, bool shared = false);
+	void release(uint32_t, int64_t);
+	void release_all(int64_t);
+	int8_t insert_record(int32_t, uint8_t*, const Variant&, int64_t);
 	bucket_lock* locks;
+	// replaces the buckets when built lock-free, nullptr otherwise
+	LF_Table* lockfree;
 };
 
 /**
@@ -59,21 +81,34 @@ class SyncHash : private Hash {
  *
  * Hashes the key and uses the hash value to insert
  * a new node into the table. Replaces an already
- * existing Node
+ * existing Node. A lock-free table checks the value here since it
+ * cannot check it under a lock.
  **/
 template<class dataType>
 int8_t SyncHash::insert(uint8_t *key, dataType value, int64_t ident)
 {
-	int32_t hash = genHash(key);
+	uint64_t hashed;
+	int32_t hash = genHash(key, &hashed);
 	if (hash == -1) {
 		return -1;
 	}
+	if (lockfree != nullptr) {
+		Variant record;
+		if constexpr (!std::is_same<dataType, int64_t>::value) {
+			if (validate_key((char*)value) != 0) {
+				return -1;
+			}
+		}
+		store(record, value);
+		return insert_record(hash, key, record, ident);
+	}
 	acquire(hash, ident);
-	if (Hash::insert(key, value) == -1) {
-		return -1;
+	int8_t ret_val = Hash::insert(hash, hashed, key, value);
+	if (ret_val == 0) {
+		log_insert(key, value);
 	}
-	release(hash);
-	return 0;
+	release(hash, ident);
+	return ret_val;
 }
 
 #endif
\ No newline at end of file
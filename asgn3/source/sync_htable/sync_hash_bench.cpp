@@ -0,0 +1,93 @@
+/**
+ * SyncHash placement benchmark
+ *
+ * Runs N threads of lookups with a few inserts against one SyncHash and
+ * reports operations per second, first with threads left to the
+ * scheduler and default placement, then with every thread pinned to a
+ * core and the bucket heads and locks interleaved over the NUMA nodes.
+ *
+ * usage: ./sync_hash_bench [max_threads] [ops_per_thread] [buckets]
+ *
+ * @author Perry David Ralston Jr
+ * @date 12/11/2020
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "placement.h"
+#include "sync_hash.h"
+
+static const int KEY_COUNT = 1024;
+// one insert for every INSERT_EVERY operations
+static const int INSERT_EVERY = 20;
+
+struct worker {
+	SyncHash *table;
+	int64_t ident;
+	int64_t ops;
+	bool pin;
+};
+
+void *run(void *arg)
+{
+	worker *self = (worker *)arg;
+	uint8_t key[SyncHash::DEFAULT_SIZE];
+	int64_t value;
+	if(self->pin && pin_thread(self->ident) == -1)
+		warn("pin_thread");
+	uint32_t seed = self->ident * 2654435761u + 1;
+	for(int64_t i = 0; i < self->ops; ++i) {
+		seed = seed * 1103515245 + 12345;
+		snprintf((char *)key, sizeof(key), "k%u", (seed >> 8) % KEY_COUNT);
+		if(i % INSERT_EVERY == 0) {
+			self->table->insert<int64_t>(key, i, self->ident);
+		} else {
+			self->table->lookup(key, value, self->ident);
+		}
+	}
+	return NULL;
+}
+
+double bench(SyncHash *table, int num_threads, int64_t ops, bool pin)
+{
+	worker *workers = (worker *)calloc(num_threads, sizeof(worker));
+	pthread_t *tids = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+	double begin = now();
+	for(int i = 0; i < num_threads; ++i) {
+		workers[i] = {table, i, ops, pin};
+		pthread_create(&tids[i], NULL, run, &workers[i]);
+	}
+	for(int i = 0; i < num_threads; ++i) {
+		pthread_join(tids[i], NULL);
+	}
+	double elapsed = now() - begin;
+	free(workers);
+	free(tids);
+	return num_threads * ops / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	int max_threads = argc > 1 ? atoi(argv[1]) : 16;
+	int64_t ops = argc > 2 ? atol(argv[2]) : 20000;
+	size_t buckets = argc > 3 ? atol(argv[3]) : 1024;
+	// each table truncates the log in its directory when it opens it
+	Log_Dir unpinned_dir("sync_hash_bench"), pinned_dir("sync_hash_bench");
+	SyncHash *unpinned = new SyncHash(buckets, Hash::DEFAULT_RECUR, unpinned_dir.path);
+	SyncHash *pinned = new SyncHash(buckets, Hash::DEFAULT_RECUR, pinned_dir.path);
+	pinned->interleave_memory();
+	printf("%d NUMA node(s)\n", node_count());
+	printf("%8s %20s %20s\n", "threads", "unpinned (ops/s)", "pinned (ops/s)");
+	for(int n = 1; n <= max_threads; n *= 2) {
+		double loose = bench(unpinned, n, ops, false);
+		double bound = bench(pinned, n, ops, true);
+		printf("%8d %20.0f %20.0f\n", n, loose, bound);
+	}
+	delete unpinned;
+	delete pinned;
+	return 0;
+}
@@ -0,0 +1,120 @@
+/** Work_Deque header file
+ *  Fixed size Chase-Lev style work stealing deque. Only the owning
+ *  worker pushes, at the bottom. The owner and any thief take from the
+ *  top with a CAS, so a worker round-robins through its own connections
+ *  while idle workers steal the oldest ones.
+ *
+ *  @author Perry David Ralston Jr.
+ *  @date 12/04/2020
+ */
+
+#ifndef WORK_DEQUE
+#define WORK_DEQUE
+
+#include <atomic>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "mpmc_queue.h"
+
+template<class T>
+class Work_Deque
+{
+  private:
+	std::atomic<T> *items;
+	int64_t mask;
+	alignas(CACHE_LINE) std::atomic<int64_t> top;
+	alignas(CACHE_LINE) std::atomic<int64_t> bottom;
+
+  public:
+	static const size_t DEFAULT_SIZE = 256;
+	Work_Deque() : Work_Deque(DEFAULT_SIZE){};
+	Work_Deque(size_t);
+	~Work_Deque();
+	bool push(T);
+	bool steal(T &);
+	bool isEmpty()
+	{
+		return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+	}
+	size_t size()
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_relaxed);
+		return b > t ? b - t : 0;
+	}
+};
+
+/**
+ * Constructor
+ * @param size: requested capacity, rounded up to a power of two
+ **/
+template<class T>
+Work_Deque<T>::Work_Deque(size_t size)
+{
+	size_t cap = 2;
+	while(cap < size) {
+		cap <<= 1;
+	}
+	mask = cap - 1;
+	items = new std::atomic<T>[cap];
+	top.store(0, std::memory_order_relaxed);
+	bottom.store(0, std::memory_order_relaxed);
+}
+
+template<class T>
+Work_Deque<T>::~Work_Deque()
+{
+	delete[] items;
+	items = nullptr;
+}
+
+/**
+ * push
+ * @param data: item to add to the bottom of the deque
+ * @return: false if the deque is full
+ *
+ * Must only be called by the owning worker.
+ **/
+template<class T>
+bool Work_Deque<T>::push(T data)
+{
+	int64_t b = bottom.load(std::memory_order_relaxed);
+	int64_t t = top.load(std::memory_order_acquire);
+	if(b - t > mask) {
+		return false;
+	}
+	items[b & mask].store(data, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+/**
+ * steal
+ * @param data: reference to store the oldest item in
+ * @return: false if the deque is empty
+ *
+ * Safe to call from any thread, including the owner. Retries when another
+ * thread takes the same item first.
+ **/
+template<class T>
+bool Work_Deque<T>::steal(T &data)
+{
+	while(true) {
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+		if(t >= b) {
+			return false;
+		}
+		data = items[t & mask].load(std::memory_order_relaxed);
+		if(top.compare_exchange_strong(
+			 t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			return true;
+		}
+	}
+}
+
+#endif